@@ -0,0 +1,76 @@
+#!/bin/bash
+
+# scaling benchmark of prod-con: sweeps mesh size, mesh type, block shape, producer fraction, and transport over a
+# range of rank counts, appending one row per run to a single CSV file (see the --csv option of prod-con)
+#
+# settings, as environment variables (defaults in parentheses):
+# RANKS         numbers of MPI ranks ("2 4 8")
+# SCALING       strong: the mesh size is fixed; weak: the mesh size grows with the ranks so that the number of
+#               cells per rank stays that of the first rank count (strong)
+# SIZES         mesh sizes (vertices per side) at the first rank count ("32 64")
+# TYPES         mesh types, 0 = hex, 1 = tet, 2 = structured hex ("0 1")
+# SLABS         block shapes, 0 = cubes, 1 = slabs ("0 1")
+# PFRACS        fractions of the ranks in the producer ("0.5")
+# MODES         transports, memory, passthru, shm, shmz (shm compressed between nodes), and/or native (messages with
+#               the sets and tags) ("memory passthru")
+# NTRIALS       trials per run (3)
+# EXTRA         additional prod-con options ("")
+# MPIEXEC       MPI launcher (mpiexec)
+# OUT           results file (bench.csv)
+# LOG           output of the runs (bench.log)
+#
+# e.g., RANKS="4 8 16" SCALING=weak SIZES=64 TYPES=1 ./bench.sh
+
+RANKS=${RANKS:-"2 4 8"}
+SCALING=${SCALING:-strong}
+SIZES=${SIZES:-"32 64"}
+TYPES=${TYPES:-"0 1"}
+SLABS=${SLABS:-"0 1"}
+PFRACS=${PFRACS:-"0.5"}
+MODES=${MODES:-"memory passthru"}
+NTRIALS=${NTRIALS:-3}
+EXTRA=${EXTRA:-""}
+MPIEXEC=${MPIEXEC:-mpiexec}
+OUT=${OUT:-bench.csv}
+LOG=${LOG:-bench.log}
+
+first_ranks=${RANKS%% *}
+
+for n in $RANKS; do
+for size in $SIZES; do
+
+    # weak scaling: (size - 1)^3 cells grow in proportion to the ranks
+    if [ "$SCALING" = "weak" ]; then
+        size=$(awk -v s=$size -v n=$n -v n0=$first_ranks 'BEGIN { printf "%d", (s - 1) * (n / n0) ^ (1 / 3) + 1.5 }')
+    fi
+
+for type in $TYPES; do
+for slab in $SLABS; do
+for pfrac in $PFRACS; do
+for mode in $MODES; do
+
+    if [ "$mode" = "memory" ]; then
+        transport="-m 1 -f 0"
+    elif [ "$mode" = "shm" ]; then
+        transport="-m 1 -f 0 --xfer shm"
+    elif [ "$mode" = "shmz" ]; then
+        transport="-m 1 -f 0 --xfer shm --compress all"
+    elif [ "$mode" = "native" ]; then
+        transport="-m 1 -f 0 --xfer native"
+    else
+        transport="-m 0 -f 1"
+    fi
+
+    echo "bench: $n ranks size $size type $type slab $slab p_frac $pfrac $mode"
+    $MPIEXEC -n $n ./prod-con --mesh_size $size --mesh_type $type --mesh_slab $slab -p $pfrac $transport \
+        --ntrials $NTRIALS --stats 0 --timers "" --csv $OUT $EXTRA >> $LOG 2>&1 ||
+        echo "bench: run failed, see $LOG"
+
+done
+done
+done
+done
+done
+done
+
+echo "bench: results in $OUT"
@@ -9,41 +9,133 @@ void consumer_f (
         const std::vector<communicator>& intercomms,
         bool shared,
         int metadata,
-        int passthru);
-}
+        int passthru,
+        const TaskParams& params);
 
-void consumer_f (
+void* consumer_init (
         communicator& local,
         const std::vector<communicator>& intercomms,
         bool shared,
         int metadata,
-        int passthru)
+        int passthru,
+        const TaskParams& params);
+
+void consumer_run (
+        void* task,
+        const TaskParams& params);
+
+void consumer_finalize (
+        void* task);
+}
+
+// state of the consumer built once by consumer_init and reused by every consumer_run: communicators, lowfive
+// plugin and callbacks, and the moab instance
+struct ConsumerTask
 {
-    diy::mpi::communicator local_(local);
+    communicator                    local;
+    std::vector<communicator>       intercomms;
+    bool                            shared;
+    int                             metadata;
+    int                             passthru;
+
     std::string infile      = "example1.h5m";
     std::string read_opts   = "PARALLEL=READ_PART;PARTITION=PARALLEL_PARTITION;PARALLEL_RESOLVE_SHARED_ENTS;DEBUG_IO=3;";
     std::string outfile     = "example1_cons.h5m";      // for debugging
     std::string write_opts  = "PARALLEL=WRITE_PART;DEBUG_IO=6";
 
-    // debug
-    fmt::print(stderr, "consumer: local comm rank {} size {} metadata {} passthru {}\n",
-            local_.rank(), local_.size(), metadata, passthru);
+    std::vector<std::string>        infiles;            // input files, in the order they are read
+    std::vector<std::string>        outfiles;           // output files for debugging, one per input file
+    PhaseTimers                     timers;             // phase timers of the current setup or trial
 
-    int nafc = 0;               // number of times after file close callback was called
+    l5::DistMetadataVOL*            vol_plugin = NULL;  // lowfive plugin (not shared mode)
+    MeshXfer*                       xfer = NULL;        // transport of the mesh without files (--xfer other than lowfive)
 
-    // wait for data to be ready
-    if (passthru && !metadata && !shared)
+    Interface*                      mbi = NULL;         // moab interface, emptied before loading each mesh
+    ParallelComm*                   pc  = NULL;         // moab communicator of the loaded mesh
+    MeshIndex                       index;              // entities of the mesh received through xfer
+
+    std::thread                     writer;             // background write of a snapshot of the mesh (--out_async)
+    std::vector<char>               snapshot;           // the mesh being written, packed by PackMesh
+    std::vector<char>               snapshot_sets;      // its sets and tags, packed by PackSets
+    communicator                    writer_comm;        // duplicate of local for the collectives of the writer
+};
+
+// set in the writer thread, whose file open needs no broadcast of the lowfive files
+static thread_local bool snapshot_writer = false;
+
+// writes a snapshot of the consumer mesh, packed by PackMesh with its sets and tags, from a moab instance of its own
+// UnpackMesh recreates the part sets as the partition, so the file matches an inline write
+// runs in the writer thread, with communication over writer_comm only
+static void write_snapshot(ConsumerTask* t,
+        std::string filename)
+{
+    snapshot_writer = true;
+    PhaseTimer debug_write(&t->timers, PHASE_DEBUG_WRITE);
+    ErrorCode rval;
+    Interface* mbi = new Core();
+    ParallelComm* pc = new ParallelComm(mbi, t->writer_comm);
+    EntityHandle root;
+    rval = mbi->create_meshset(MESHSET_SET, root); ERR(rval);
+
+    MeshIndex index;
+    UnpackMesh(mbi, pc, root, std::vector<const char*>(1, &t->snapshot[0]), index);
+    rval = mbi->write_file(filename.c_str(), 0, t->write_opts.c_str(), &root, 1); ERR(rval);
+
+    delete pc;
+    delete mbi;
+}
+
+// waits for the background write, if any, to finish
+static void join_writer(ConsumerTask* t)
+{
+    if (t->writer.joinable())
     {
-        for (auto& intercomm: intercomms)
-            diy_comm(intercomm).barrier();
+        PhaseTimer wait(&t->timers, PHASE_WAIT);
+        t->writer.join();
     }
-    fmt::print(stderr, "*** consumer after barrier completed! ***\n");
+}
+
+// builds the consumer: lowfive plugin and callbacks, and the moab instance
+void* consumer_init (
+        communicator& local,
+        const std::vector<communicator>& intercomms,
+        bool shared,
+        int metadata,
+        int passthru,
+        const TaskParams& params)
+{
+    ConsumerTask* t = new ConsumerTask;
+    t->local        = local;
+    t->intercomms   = intercomms;
+    t->shared       = shared;
+    t->metadata     = metadata;
+    t->passthru     = passthru;
+
+    diy::mpi::communicator local_(local);
+    double t0 = MPI_Wtime();
+
+    // debug
+    fmt::print(stderr, "consumer: local comm rank {} size {} metadata {} passthru {}\n",
+            local_.rank(), local_.size(), metadata, passthru);
+
+    // input files: infile, one file per z-slab when the producer streams the mesh within a memory budget, or one
+    // file per time step (output files for debugging likewise, one per input file)
+    int prod_size = local_.size();
+    if (!shared)
+        MPI_Comm_remote_size(intercomms[0], &prod_size);
+    t->infiles  = MeshFilenames(t->infile, params, prod_size);
+    TaskParams out_params = params;             // debug output files always hold the whole mesh
+    out_params.delta = 0;
+    t->outfiles = MeshFilenames(t->outfile, out_params, prod_size);
+    std::string in_pattern  = MeshPattern(t->infile, params);
+    std::string out_pattern = MeshPattern(t->outfile, params);
 
     if (shared)                     // single process, MetadataVOL test
         fmt::print(stderr, "consumer: using shared mode MetadataVOL plugin created by prod-con\n");
     else                            // normal multiprocess, DistMetadataVOL plugin
     {
         l5::DistMetadataVOL& vol_plugin = l5::DistMetadataVOL::create_DistMetadataVOL(local, intercomms);
+        t->vol_plugin = &vol_plugin;
 
         // set lowfive properties
         if (passthru)
@@ -51,17 +143,17 @@ void consumer_f (
             // debug
             fmt::print(stderr, "*** consumer setting passthru mode\n");
 
-            vol_plugin.set_passthru(infile, "*");
+            vol_plugin.set_passthru(in_pattern, "*");
         }
         if (metadata)
         {
             // debug
             fmt::print(stderr, "*** consumer setting memory mode\n");
 
-            vol_plugin.set_memory(infile, "*");
+            vol_plugin.set_memory(in_pattern, "*");
         }
-        vol_plugin.set_passthru(outfile, "*");      // outfile for debugging goes to disk
-        vol_plugin.set_intercomm(infile, "*", 0);
+        vol_plugin.set_passthru(out_pattern, "*");  // outfile for debugging goes to disk
+        vol_plugin.set_intercomm(in_pattern, "*", 0);
 
         vol_plugin.set_keep(true);
         vol_plugin.serve_on_close = false;
@@ -71,31 +163,257 @@ void consumer_f (
         // however, no after_file_close callback because the outfile is always passthru (file on disk)
 
         // set a callback to broadcast/receive files before a file open
-        vol_plugin.set_before_file_open([&](const std::string& name)
+        vol_plugin.set_before_file_open([t](const std::string& name)
         {
-            if (name == outfile)
-                vol_plugin.broadcast_files();
+            // a background write runs while the main thread may be using the plugin
+            if (snapshot_writer)
+                return;
+            if (std::find(t->outfiles.begin(), t->outfiles.end(), name) != t->outfiles.end())
+            {
+                PhaseTimer broadcast(&t->timers, PHASE_BROADCAST);
+                t->vol_plugin->broadcast_files();
+            }
         });
     }
 
+    // transport of the mesh from the producer without files
+    if (UseMeshXfer(params, shared))
+        t->xfer = new MeshXfer(intercomms[0], false, params.xfer == "native", params.repart, params.compress);
+
     // initialize moab
-    Interface*                      mbi = new Core();                       // moab interface
-    ParallelComm*                   pc  = new ParallelComm(mbi, local);     // moab communicator
-    EntityHandle                    root;
-    ErrorCode                       rval;
-    rval = mbi->create_meshset(MESHSET_SET, root); ERR(rval);
+    t->mbi = new Core();
+    MPI_Comm_dup(local, &t->writer_comm);
 
-    // debug
-    fmt::print(stderr, "*** consumer before reading file ***\n");
+    // setup time
+    double setup = MPI_Wtime() - t0;
+    MPI_Allreduce(MPI_IN_PLACE, &setup, 1, MPI_DOUBLE, MPI_MAX, local);
+    if (local_.rank() == 0)
+        fmt::print(stderr, "consumer: setup {:.3f} s\n", setup);
+    TaskParams setup_params = params;
+    setup_params.trial = -1;
+    ReportPhaseTimers(t->timers, "consumer", local, setup_params);
 
-    // read file
-    rval = mbi->load_file(infile.c_str(), &root, read_opts.c_str() ); ERR(rval);
+    return t;
+}
 
-    // debug
-    fmt::print(stderr, "*** consumer after reading file ***\n");
+// one trial of the consumer: reads and verifies each time step (or each slab of a streamed mesh)
+void consumer_run (
+        void* task,
+        const TaskParams& params)
+{
+    ConsumerTask* t = static_cast<ConsumerTask*>(task);
+    diy::mpi::communicator local_(t->local);
+    t->timers = PhaseTimers();
+    int nsteps = NumSteps(params);
 
-    // write file for debugging
-    rval = mbi->write_file(outfile.c_str(), 0, write_opts.c_str(), &root, 1); ERR(rval);
-    fmt::print(stderr, "*** consumer wrote the file for debug ***\n");
+    // the input files are read one at a time, and each is released before reading the next, except that a mesh
+    // is kept when the next time steps carry only its fields
+    Interface*                          mbi = t->mbi;                           // moab interface
+    EntityHandle                        root;
+    ErrorCode                           rval;
+    int                                 mesh_version = -1;                      // version of the loaded mesh topology
+    double start = MPI_Wtime();
+    double max_latency = 0;                     // maximum over steps of the time from waiting for a step to having it
+    unsigned long long bytes = 0;               // bytes received on this rank (datasets read, or bytes transferred;
+                                                // none when viewing the producer mesh in place)
+    for (size_t i = 0; i < t->infiles.size(); i++)
+    {
+        double t0 = MPI_Wtime();
+
+        // wait for data to be ready: every time step, or all the slabs at once
+        if (t->passthru && !t->metadata && !t->shared && !t->xfer && (i == 0 || nsteps > 1))
+        {
+            PhaseTimer wait(&t->timers, PHASE_WAIT);
+            for (auto& intercomm: t->intercomms)
+                diy_comm(intercomm).barrier();
+            fmt::print(stderr, "*** consumer after barrier completed! ***\n");
+        }
+
+        // concurrent with the producer: wait for the file
+        if (params.handoff)
+        {
+            PhaseTimer wait(&t->timers, PHASE_WAIT);
+            params.handoff->begin_read(i);
+        }
+
+        // debug
+        fmt::print(stderr, "*** consumer before reading file {} ***\n", t->infiles[i]);
+
+        // packed meshes of the producer ranks of this rank, received through xfer
+        std::vector<const char*> packed;
+        if (t->xfer)
+        {
+            size_t packed_bytes;
+            packed = t->xfer->receive(i, !DeltaStep(params, i), &t->timers, packed_bytes);
+            bytes += packed_bytes;
+        }
+
+        // the background write and the load take turns accessing HDF5
+        if (!t->xfer && !UseMeshView(params, t->shared))
+            join_writer(t);
+
+        PhaseTimer load(&t->timers, PHASE_LOAD);
+        if (UseMeshView(params, t->shared))
+        {
+            // the producer mesh in place, read only
+            mbi             = params.view->mbi;
+            root            = params.view->root;
+            mesh_version    = params.view->version;
+        }
+        else if (t->xfer && DeltaStep(params, i))
+        {
+            // patch the fields of the mesh in place
+            if (!UnpackFields(mbi, packed, t->index))
+            {
+                if (params.handoff)
+                    params.handoff->end_read(i);
+                break;
+            }
+            mesh_version = t->index.version;
+        }
+        else if (DeltaStep(params, i))
+        {
+            // patch the fields of the mesh in place
+            size_t field_bytes;
+            if (!ReadFields(mbi, root, t->infiles[i], mesh_version, t->local, field_bytes))
+            {
+                if (params.handoff)
+                    params.handoff->end_read(i);
+                break;
+            }
+            bytes += field_bytes;
+        }
+        else
+        {
+            // empty the moab instance
+            delete t->pc;
+            rval = mbi->delete_mesh(); ERR(rval);
+            t->pc = new ParallelComm(mbi, t->local);
+            rval = mbi->create_meshset(MESHSET_SET, root); ERR(rval);
+
+            if (t->xfer)
+            {
+                // create the mesh from the packed meshes
+                UnpackMesh(mbi, t->pc, root, packed, t->index);
+                mesh_version = t->index.version;
+            }
+            else
+            {
+                // read file, and drop what the consumer does not need; the global ids patch later fields and pack
+                // snapshots
+                rval = mbi->load_file(t->infiles[i].c_str(), &root, t->read_opts.c_str() ); ERR(rval);
+                mesh_version = GetMeshVersion(mbi);
+                bytes += MeshDataBytes(mbi);
+                SelectMesh(mbi, root, params.select, params.delta || params.out_async);
+            }
+        }
+        load.stop();
+
+        // debug
+        fmt::print(stderr, "*** consumer after reading file ***\n");
+
+        double t1 = MPI_Wtime();
+
+        // verify the fields transferred with the mesh
+        double factor = nsteps > 1 ? StepFactor(i) : StepFactor(0);    // scaling factor on field values, as in the producer
+        // fields quantized by the transfer are within the compression tolerance, up to the rounding of the quantized
+        // values back to doubles
+        double tol = 1e-12;
+        if (t->xfer && (params.compress.datasets & MeshCompress::FIELDS) && params.compress.tol > 0)
+            tol = params.compress.tol + 1e-12;
+        PhaseTimer verify(&t->timers, PHASE_VERIFY);
+        int fields_ok = 1;
+        if (params.select.tag("vertex_field"))
+            fields_ok &= GetVertexField(mbi, root, "vertex_field", factor, t->local, params.threads, false, tol);
+        if (params.select.dim >= 3 && params.select.tag("element_field"))
+            fields_ok &= GetElementField(mbi, root, "element_field", factor, t->local, params.threads, false, tol);
+        verify.stop();
+
+        // a field that does not match what the producer wrote means the transfer is broken, so the run stops
+        MPI_Allreduce(MPI_IN_PLACE, &fields_ok, 1, MPI_INT, MPI_MIN, t->local);
+        if (!fields_ok)
+        {
+            if (local_.rank() == 0)
+                fmt::print(stderr, "consumer: fields of step {} do not match the producer, aborting\n", i);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        // latency of the step, over all ranks
+        double latency = t1 - t0;
+        MPI_Allreduce(MPI_IN_PLACE, &latency, 1, MPI_DOUBLE, MPI_MAX, t->local);
+        max_latency = std::max(max_latency, latency);
+        if (local_.rank() == 0 && nsteps > 1)
+            fmt::print(stderr, "consumer: step {} latency {:.3f} s\n", i, latency);
+
+        // write file for debugging, every out_every steps
+        // in the background from a snapshot, unless concurrent with the producer, whose I/O takes turns with this one
+        if (params.out_every > 0 && i % params.out_every == 0)
+        {
+            if (params.out_async && !params.handoff)
+            {
+                join_writer(t);
+                PhaseTimer snapshot(&t->timers, PHASE_SNAPSHOT);
+                PackSets(mbi, root, params.select, t->snapshot_sets);
+                t->snapshot.resize(PackMesh(mbi, root, mesh_version, true, params.select, NULL, &t->snapshot_sets));
+                PackMesh(mbi, root, mesh_version, true, params.select, &t->snapshot[0], &t->snapshot_sets);
+                snapshot.stop();
+                t->writer = std::thread(write_snapshot, t, t->outfiles[i]);
+            }
+            else
+            {
+                PhaseTimer debug_write(&t->timers, PHASE_DEBUG_WRITE);
+                rval = mbi->write_file(t->outfiles[i].c_str(), 0, t->write_opts.c_str(), &root, 1); ERR(rval);
+                debug_write.stop();
+                fmt::print(stderr, "*** consumer wrote the file for debug ***\n");
+            }
+        }
+
+        if (params.handoff)
+            params.handoff->end_read(i);
+    }
+    if (t->xfer)
+        t->xfer->finish(&t->timers);
+    join_writer(t);
+    if (params.received)
+        *params.received = bytes;
+
+    // sustained throughput over all the steps
+    double elapsed = MPI_Wtime() - start;
+    MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX, t->local);
+    MPI_Allreduce(MPI_IN_PLACE, &bytes, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, t->local);
+    if (local_.rank() == 0 && UseMeshView(params, t->shared))
+        fmt::print(stderr, "consumer: {} files viewed in place in {:.3f} s, {:.2f} files/s, max latency {:.3f} s\n",
+                t->infiles.size(), elapsed, t->infiles.size() / elapsed, max_latency);
+    else if (local_.rank() == 0)
+        fmt::print(stderr, "consumer: {} files {:.1f} MB in {:.3f} s, {:.2f} files/s {:.1f} MB/s, max latency {:.3f} s\n",
+                t->infiles.size(), bytes / 1048576.0, elapsed, t->infiles.size() / elapsed, bytes / 1048576.0 / elapsed,
+                max_latency);
+
+    ReportPhaseTimers(t->timers, "consumer", t->local, params);
 }
 
+// releases the moab instance
+void consumer_finalize (
+        void* task)
+{
+    ConsumerTask* t = static_cast<ConsumerTask*>(task);
+    MPI_Comm_free(&t->writer_comm);
+    delete t->xfer;
+    delete t->pc;
+    delete t->mbi;
+    delete t;
+}
+
+// the whole consumer in one call: setup, one trial, and cleanup
+void consumer_f (
+        communicator& local,
+        const std::vector<communicator>& intercomms,
+        bool shared,
+        int metadata,
+        int passthru,
+        const TaskParams& params)
+{
+    void* task = consumer_init(local, intercomms, shared, metadata, passthru, params);
+    consumer_run(task, params);
+    consumer_finalize(task);
+}
@@ -0,0 +1,195 @@
+// micro-benchmark for global id assignment of the generated meshes:
+// per-entity tag_set_data (the original loop) vs. bulk kernels writing to the dense tag storage
+
+#include    <diy/mpi.hpp>
+#include    "opts.h"
+
+#include    "prod-con.hpp"
+
+// sets global ids of a single-block hex or tet mesh one entity at a time with tag_set_data
+void loop_gids(int *mesh_size,                  // mesh size (i,j,k) number of vertices in each dim
+        Interface *mbint,                       // moab interface instance
+        Tag global_id_tag,                      // global id tag
+        const Bounds& bounds,                   // block bounds
+        EntityHandle startv,                    // first vertex
+        EntityHandle startc,                    // first cell
+        int cells_per_space)                    // number of cells per grid space (1 = hex, 6 = tet)
+{
+    ErrorCode rval;
+    EntityHandle handle;
+    long gid;
+
+    // gids for vertices, starting at 1 by moab convention
+    handle = startv;
+    for (int k = bounds.min[2]; k < bounds.max[2] + 1; k++)
+    {
+        for (int j = bounds.min[1]; j < bounds.max[1] + 1; j++)
+        {
+            for (int i = bounds.min[0]; i < bounds.max[0] + 1; i++)
+            {
+                gid = (long)1 + (long)i + (long)j * (mesh_size[0]) +
+                    (long)k * (mesh_size[0]) * (mesh_size[1]);
+                rval = mbint->tag_set_data(global_id_tag, &handle, 1, &gid); ERR;
+                handle++;
+            }
+        }
+    }
+
+    // gids for cells, starting at 1 by moab convention
+    handle = startc;
+    for (int k = bounds.min[2]; k < bounds.max[2]; k++)
+    {
+        for (int j = bounds.min[1]; j < bounds.max[1]; j++)
+        {
+            for (int i = bounds.min[0]; i < bounds.max[0]; i++)
+            {
+                for (int t = 0; t < cells_per_space; t++)
+                {
+                    gid = (long)1 + (long)t +  (long)i * cells_per_space +
+                        (long)j * cells_per_space * (mesh_size[0] - 1) +
+                        (long)k * cells_per_space * (mesh_size[0] - 1) * (mesh_size[1] - 1);
+                    rval = mbint->tag_set_data(global_id_tag, &handle, 1, &gid); ERR;
+                    handle++;
+                }
+            }
+        }
+    }
+}
+
+// sets global ids of a single-block hex or tet mesh in bulk with the kernels used by the mesh generators
+void bulk_gids(int *mesh_size,                  // mesh size (i,j,k) number of vertices in each dim
+        Interface *mbint,                       // moab interface instance
+        Tag global_id_tag,                      // global id tag
+        const Bounds& bounds,                   // block bounds
+        EntityHandle startv,                    // first vertex
+        int num_verts,                          // number of vertices
+        EntityHandle startc,                    // first cell
+        int num_cells,                          // number of cells
+        int cells_per_space,                    // number of cells per grid space (1 = hex, 6 = tet)
+        int threads)                            // number of threads
+{
+    // all vertices in the bounds belong to the block
+    VertRows rows;
+    int nx = bounds.max[0] - bounds.min[0] + 1;
+    int nrows = (bounds.max[1] - bounds.min[1] + 1) * (bounds.max[2] - bounds.min[2] + 1);
+    for (int r = 0; r < nrows; r++)
+    {
+        rows.lo.push_back(bounds.min[0]);
+        rows.hi.push_back(bounds.max[0]);
+        rows.off.push_back(r * nx);
+    }
+
+    long* gids = (long*)dense_tag_data(mbint, global_id_tag, startv, num_verts);
+    assert(gids);
+    vert_gids_kernel(mesh_size, bounds, rows, gids, threads);
+
+    gids = (long*)dense_tag_data(mbint, global_id_tag, startc, num_cells);
+    assert(gids);
+    cell_gids_kernel(mesh_size, bounds, cells_per_space, gids, threads);
+}
+
+int main(int argc, char* argv[])
+{
+    diy::mpi::environment     env(argc, argv);
+    diy::mpi::communicator    world;
+
+    int                       min_size          = 16;             // smallest mesh size per side
+    int                       max_size          = 128;            // largest mesh size per side
+    int                       threads           = 1;              // number of threads for the bulk kernels
+    bool                      help;
+
+    // get command line arguments
+    using namespace opts;
+    Options ops;
+    ops
+        >> Option('t', "thread",    threads,        "number of threads")
+        >> Option(     "min",       min_size,       "smallest mesh size (vertices per side)")
+        >> Option(     "max",       max_size,       "largest mesh size (vertices per side)")
+        >> Option('h', "help",      help,           "show help")
+        ;
+
+    if (!ops.parse(argc,argv) || help)
+    {
+        if (world.rank() == 0)
+        {
+            std::cout << "Usage: " << argv[0] << " [OPTIONS]\n";
+            std::cout << "Compares per-entity and bulk global id assignment for hex and tet meshes of doubling sizes.\n";
+            std::cout << ops;
+        }
+        return 1;
+    }
+
+    if (world.rank() == 0)
+        fmt::print(stderr, "{:>5} {:>8} {:>14} {:>12} {:>12} {:>10}\n",
+                "type", "size", "entities", "loop (s)", "bulk (s)", "speedup");
+
+    for (int cell_type = 0; cell_type < 2; cell_type++)            // 0 = hex, 1 = tet
+    {
+        int cells_per_space = cell_type == 0 ? 1 : 6;
+        int verts_per_cell  = cell_type == 0 ? 8 : 4;
+
+        for (int size = min_size; size <= max_size; size *= 2)
+        {
+            int mesh_size[3] = {size, size, size};
+            Bounds bounds(3);
+            for (int i = 0; i < 3; i++)
+            {
+                bounds.min[i] = 0;
+                bounds.max[i] = size - 1;
+            }
+
+            // allocate the vertex and cell sequences of a single block mesh
+            Interface*      mbi = new Core();
+            ReadUtilIface*  iface;
+            ErrorCode       rval;
+            rval = mbi->query_interface(iface); ERR;
+
+            std::vector<double*> arrays;
+            EntityHandle startv, startc, *starth;
+            int num_verts = size * size * size;
+            int num_cells = cells_per_space * (size - 1) * (size - 1) * (size - 1);
+            rval = iface->get_node_coords(3, num_verts, 0, startv, arrays); ERR;
+            rval = iface->get_element_connect(num_cells, verts_per_cell, cell_type == 0 ? MBHEX : MBTET,
+                    0, startc, starth); ERR;
+            std::fill(starth, starth + (size_t)num_cells * verts_per_cell, startv);
+
+            // separate tags so that both methods pay for allocating the dense tag storage
+            Tag loop_tag, bulk_tag;
+            rval = mbi->tag_get_handle("HANDLEID_LOOP", sizeof(long), MB_TYPE_OPAQUE,
+                    loop_tag, MB_TAG_CREAT|MB_TAG_DENSE); ERR;
+            rval = mbi->tag_get_handle("HANDLEID_BULK", sizeof(long), MB_TYPE_OPAQUE,
+                    bulk_tag, MB_TAG_CREAT|MB_TAG_DENSE); ERR;
+
+            double t0 = MPI_Wtime();
+            loop_gids(mesh_size, mbi, loop_tag, bounds, startv, startc, cells_per_space);
+            double loop_time = MPI_Wtime() - t0;
+
+            t0 = MPI_Wtime();
+            bulk_gids(mesh_size, mbi, bulk_tag, bounds, startv, num_verts, startc, num_cells,
+                    cells_per_space, threads);
+            double bulk_time = MPI_Wtime() - t0;
+
+            // check that both methods agree
+            std::vector<long> loop_vals(num_verts + num_cells), bulk_vals(num_verts + num_cells);
+            Range ents(startv, startv + num_verts - 1);
+            ents.insert(startc, startc + num_cells - 1);
+            rval = mbi->tag_get_data(loop_tag, ents, &loop_vals[0]); ERR;
+            rval = mbi->tag_get_data(bulk_tag, ents, &bulk_vals[0]); ERR;
+            if (loop_vals != bulk_vals)
+                fmt::print(stderr, "Error: rank {} global ids differ for {} mesh of size {}\n",
+                        world.rank(), cell_type == 0 ? "hex" : "tet", size);
+
+            // report the slowest rank
+            double max_loop_time, max_bulk_time;
+            diy::mpi::reduce(world, loop_time, max_loop_time, 0, diy::mpi::maximum<double>());
+            diy::mpi::reduce(world, bulk_time, max_bulk_time, 0, diy::mpi::maximum<double>());
+            if (world.rank() == 0)
+                fmt::print(stderr, "{:>5} {:>8} {:>14} {:>12.4f} {:>12.4f} {:>10.1f}\n",
+                        cell_type == 0 ? "hex" : "tet", size, num_verts + num_cells,
+                        max_loop_time, max_bulk_time, max_loop_time / max_bulk_time);
+
+            rval = mbi->release_interface(iface); ERR;
+            delete mbi;
+        }
+    }
+}
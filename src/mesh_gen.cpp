@@ -1,214 +1,624 @@
+#include <set>
+#include <sys/resource.h>
 #include "prod-con.hpp"
 
 using namespace std;
 using namespace moab;
 
-// generate a regular structured hex mesh
-void hex_mesh_gen(int *mesh_size,                       // mesh size (i,j,k) number of vertices in each dim
-        Interface *mbint,                               // moab interface instance
-        EntityHandle *mesh_set,                         // moab mesh set
-        ParallelComm *mbpc,                             // moab parallel communicator
-        diy::RegularDecomposer<Bounds>& decomp,         // diy decomposition
-        diy::RoundRobinAssigner& assign)                // diy assignment
+// one block of the generated mesh, processed as a diy block during mesh generation
+struct MeshBlock
 {
-    create_hexes_and_verts(mesh_size, mbint, mesh_set, decomp, assign, mbpc);
-    resolve_and_exchange(mbint, mesh_set, mbpc);
+    static void*    create()            { return new MeshBlock; }
+    static void     destroy(void* b)    { delete static_cast<MeshBlock*>(b); }
+
+    int                     gid;            // diy block global id
+    int                     lid;            // local block id in the master
+    Bounds                  bounds { 3 };   // block bounds (vertices, including shared faces and ghost layers)
+    Bounds                  core { 3 };     // block bounds without ghost layers
+    vector<EntityHandle>    vhandles;       // handles of all vertices in the bounds, i-j-k order
+    VertRows                rows;           // vertices created by this block
+    vector<int>             vorder;         // position in the vertex sequence of each vertex created by this block,
+                                            // in the order of rows (empty = the order of rows)
+    vector<int>             corder;         // position in the cell sequence of the cells of each grid space,
+                                            // in i-j-k order of the grid spaces (empty = i-j-k order)
+    int                     num_verts;      // number of vertices created by this block
+    EntityHandle            startv;         // handle for start of vertices created by this block
+    vector<double*>         arrays;         // coordinate arrays of vertices created by this block
+    int                     num_cells;      // number of cells in this block
+    EntityHandle            startc;         // handle for start of cells
+    EntityHandle*           starth;         // handle for start of connectivity
+};
+
+// adds the local blocks of the decomposition to the master
+// optionally clips the blocks to the z-planes [z0, z1], skipping blocks with no cells between them
+static void init_blocks(diy::Master& master,                    // diy master
+        diy::RegularDecomposer<Bounds>& decomp,                 // diy decomposition
+        diy::RoundRobinAssigner& assign,                        // diy assignment
+        int rank,                                               // mpi rank
+        int z0 = 0,                                             // first z-plane (vertices) to keep
+        int z1 = -1)                                            // last z-plane (vertices) to keep (< z0: no clipping)
+{
+    decomp.decompose(rank, assign, [&](int gid,
+                const Bounds& core,
+                const Bounds& bounds,
+                const Bounds&,
+                const diy::RegularGridLink& link)
+    {
+        if (z1 >= z0 && (core.max[2] <= z0 || core.min[2] >= z1))
+            return;                                             // no cells between z0 and z1
+        MeshBlock* b    = new MeshBlock;
+        b->gid          = gid;
+        b->bounds       = bounds;
+        b->core         = core;
+        if (z1 >= z0)
+        {
+            b->bounds.min[2] = b->core.min[2] = std::max(core.min[2], z0);
+            b->bounds.max[2] = b->core.max[2] = std::min(core.max[2], z1);
+        }
+        b->lid          = master.add(gid, b, new diy::RegularGridLink(link));
+    });
 }
 
-// generate a regular structured tet mesh
-void tet_mesh_gen(int *mesh_size,                        // mesh size (i,j,k) number of vertices in each dim
-        Interface *mbint,                                // moab interface instance
-        EntityHandle *mesh_set,                          // moab mesh set
-        ParallelComm *mbpc,                              // moab parallel communicator
-        diy::RegularDecomposer<Bounds>& decomp,          // diy decomposition
-        diy::RoundRobinAssigner& assign)                 // diy assignment
+// local id of the block that creates vertex (i,j,k) of local block lid
+// a vertex on a face shared by several local blocks is created only once, by the first of those blocks,
+// so that local blocks are stitched together and only vertices on inter-process faces are duplicated
+static int vert_owner(diy::Master& master,                      // diy master
+        int lid,                                                // local block id
+        int i, int j, int k)                                    // vertex coordinates
 {
-    create_tets_and_verts(mesh_size, mbint, mesh_set, decomp, assign, mbpc);
-    resolve_and_exchange(mbint, mesh_set, mbpc);
+    const Bounds& bds = master.block<MeshBlock>(lid)->bounds;
+    if (i > bds.min[0] && i < bds.max[0] && j > bds.min[1] && j < bds.max[1] && k > bds.min[2] && k < bds.max[2])
+        return lid;                                             // interior vertex, no need to search
+
+    for (int b = 0; b < lid; b++)
+    {
+        const Bounds& nbds = master.block<MeshBlock>(b)->bounds;
+        if (i >= nbds.min[0] && i <= nbds.max[0] &&
+            j >= nbds.min[1] && j <= nbds.max[1] &&
+            k >= nbds.min[2] && k <= nbds.max[2])
+            return b;
+    }
+    return lid;
 }
 
-// create hex cells and vertices
-void create_hexes_and_verts(int *mesh_size,     // mesh size (i,j,k) number of vertices in each dim
-        Interface *mbint,                       // moab interface instance
-        EntityHandle *mesh_set,                 // moab mesh set
-        diy::RegularDecomposer<Bounds>& decomp, // diy decomposition
-        diy::RoundRobinAssigner& assign,        // diy assignment
-        ParallelComm *mbpc)                     // moab communicator
+// handle of cell t of grid space (i,j,k) of a block
+static EntityHandle cell_handle(const MeshBlock* b,             // block
+        int cells_per_space,                                    // number of cells per grid space
+        int i, int j, int k,                                    // grid space (its minimum vertex)
+        int t)                                                  // cell in the grid space
 {
-    Core *mbcore = dynamic_cast<Core*>(mbint);
-    EntityHandle vs, cs;
-    ErrorCode rval;
-    EntityHandle handle;
-    vector<int> local_gids;
-    int rank;
-    MPI_Comm_rank(mbpc->comm(), &rank);
-    assign.local_gids(rank, local_gids);
-    int nblocks = local_gids.size();
-    std::vector<Bounds> bounds;
-    for (auto i = 0; i < nblocks; i++)
-        bounds.push_back(3);
-    int b; // local block number
+    const Bounds& bds = b->bounds;
+    int bnx = bds.max[0] - bds.min[0];
+    int bny = bds.max[1] - bds.min[1];
+    int sp  = (i - bds.min[0]) + (j - bds.min[1]) * bnx + (k - bds.min[2]) * bnx * bny;
+    return b->startc + (EntityHandle)cells_per_space * (b->corder.empty() ? sp : b->corder[sp]) + t;
+}
 
-    // get the read interface from moab
-    ReadUtilIface *iface;
-    rval = mbint->query_interface(iface); ERR;
+// spreads the low 21 bits of x so that there are two zero bits between consecutive bits
+static uint64_t spread_bits(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8)  & 0x100f00f00f00f00fULL;
+    x = (x | x << 4)  & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2)  & 0x1249249249249249ULL;
+    return x;
+}
 
-    // block bounds
-    for (int b = 0; b < nblocks; b++)
-        decomp.fill_bounds(bounds[b], local_gids[b], false);
+// key of grid point (x,y,z) along a space-filling curve over a cube of 2^bits points per side
+// order: 1 = Morton (z-order), 2 = Hilbert
+// the Hilbert key follows J. Skilling, Programming the Hilbert curve, AIP Conf. Proc. 707, 2004
+static uint64_t sfc_key(int order,
+        unsigned int x, unsigned int y, unsigned int z,
+        int bits)
+{
+    if (order == 1)
+        return spread_bits(x) | spread_bits(y) << 1 | spread_bits(z) << 2;
+
+    // transpose the axes into the Hilbert index, X[0] holding its most significant bits
+    unsigned int X[3] = {x, y, z};
+    unsigned int M = 1U << (bits - 1);
+    for (unsigned int Q = M; Q > 1; Q >>= 1)
+    {
+        unsigned int P = Q - 1;
+        for (int i = 0; i < 3; i++)
+        {
+            if (X[i] & Q)
+                X[0] ^= P;                              // invert
+            else
+            {
+                unsigned int t = (X[0] ^ X[i]) & P;     // exchange
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+    for (int i = 1; i < 3; i++)                         // Gray encode
+        X[i] ^= X[i - 1];
+    unsigned int t = 0;
+    for (unsigned int Q = M; Q > 1; Q >>= 1)
+        if (X[2] & Q)
+            t ^= Q - 1;
+    for (int i = 0; i < 3; i++)
+        X[i] ^= t;
+
+    return spread_bits(X[2]) | spread_bits(X[1]) << 1 | spread_bits(X[0]) << 2;
+}
+
+// number of bits needed for the grid coordinates of a block along a space-filling curve
+static int sfc_bits(const Bounds& bds)
+{
+    int n = max(bds.max[0] - bds.min[0], max(bds.max[1] - bds.min[1], bds.max[2] - bds.min[2])) + 1;
+    int bits = 1;
+    while ((1 << bits) < n)
+        bits++;
+    return bits;
+}
+
+// position of each of a set of points along a space-filling curve, given their keys
+// perm[q] = rank of keys[q] among all the keys, ties broken by q
+static void sfc_perm(const vector<uint64_t>& keys,
+        vector<int>& perm)
+{
+    vector<pair<uint64_t, int>> sorted(keys.size());
+    for (size_t q = 0; q < keys.size(); q++)
+        sorted[q] = make_pair(keys[q], (int)q);
+    sort(sorted.begin(), sorted.end());
+    perm.resize(keys.size());
+    for (size_t r = 0; r < sorted.size(); r++)
+        perm[sorted[r].second] = r;
+}
+
+// orders the vertices created by a block along a space-filling curve (order 1 = Morton, 2 = Hilbert)
+static void order_block_verts(MeshBlock* b,
+        int order)
+{
+    b->vorder.clear();
+    if (order == 0)
+        return;
+
+    const Bounds& bds = b->bounds;
+    int bits = sfc_bits(bds);
+    int ny = bds.max[1] - bds.min[1] + 1;
+    vector<uint64_t> keys(b->num_verts);
+    for (size_t r = 0; r < b->rows.lo.size(); r++)
+    {
+        int j = r % ny;
+        int k = r / ny;
+        for (int i = b->rows.lo[r]; i <= b->rows.hi[r]; i++)
+            keys[b->rows.off[r] + i - b->rows.lo[r]] = sfc_key(order, i - bds.min[0], j, k, bits);
+    }
+    sfc_perm(keys, b->vorder);
+}
+
+// orders the grid spaces of a block along a space-filling curve (order 1 = Morton, 2 = Hilbert)
+static void order_block_cells(MeshBlock* b,
+        int order)
+{
+    b->corder.clear();
+    if (order == 0)
+        return;
+
+    const Bounds& bds = b->bounds;
+    int bits = sfc_bits(bds);
+    vector<uint64_t> keys;
+    keys.reserve((size_t)(bds.max[0] - bds.min[0]) * (bds.max[1] - bds.min[1]) * (bds.max[2] - bds.min[2]));
+    for (int k = 0; k < bds.max[2] - bds.min[2]; k++)
+        for (int j = 0; j < bds.max[1] - bds.min[1]; j++)
+            for (int i = 0; i < bds.max[0] - bds.min[0]; i++)
+                keys.push_back(sfc_key(order, i, j, k, bits));
+    sfc_perm(keys, b->corder);
+}
+
+// create the vertices of all local blocks
+// on return, vhandles of each block holds the handles of all the vertices in its bounds
+static void create_block_verts(int *mesh_size,                  // mesh size (i,j,k) number of vertices in each dim
+        ReadUtilIface *iface,                                   // moab read interface
+        diy::Master& master,                                    // diy master
+        int order)                                              // vertex order (0 = i-j-k, 1 = Morton, 2 = Hilbert)
+{
+    ErrorCode rval;
 
-    // todo: multiple blocks per process not really supported yet in this example
-    b = 0;
+    // find the vertices each block creates, one contiguous range of i per (j,k) row
+    // vertices created by earlier local blocks lie on the block faces, so in a row they are either
+    // the whole row or its end points, and the remaining ones are contiguous
+    master.foreach([&](MeshBlock* b, const diy::Master::ProxyWithLink&)
+    {
+        const Bounds& bds = b->bounds;
+        int nrows = (bds.max[1] - bds.min[1] + 1) * (bds.max[2] - bds.min[2] + 1);
+        b->rows.lo.resize(nrows);
+        b->rows.hi.resize(nrows);
+        b->rows.off.resize(nrows);
+        b->num_verts = 0;
+        int r = 0;
+        for (int k = bds.min[2]; k <= bds.max[2]; k++)
+        {
+            for (int j = bds.min[1]; j <= bds.max[1]; j++)
+            {
+                int lo = bds.min[0];
+                int hi = bds.max[0];
+                while (lo <= hi && vert_owner(master, b->lid, lo, j, k) != b->lid)
+                    lo++;
+                while (hi >= lo && vert_owner(master, b->lid, hi, j, k) != b->lid)
+                    hi--;
+                b->rows.lo[r]   = lo;
+                b->rows.hi[r]   = hi;
+                b->rows.off[r]  = b->num_verts;
+                b->num_verts    += hi - lo + 1;
+                r++;
+            }
+        }
+        order_block_verts(b, order);
+    });
 
     // the following method is based on the example in
     // moab/examples/old/FileRead.cpp, using the ReadUtilIface class
 
-    // allocate a block of vertex handles and store xyz’s into them
-    // returns a starting handle for the node sequence
-    vector<double*> arrays;
-    EntityHandle startv;
-    int num_verts =
-        (bounds[b].max[0] - bounds[b].min[0] + 1) *
-        (bounds[b].max[1] - bounds[b].min[1] + 1) *
-        (bounds[b].max[2] - bounds[b].min[2] + 1);
-    rval = iface->get_node_coords(3, num_verts, 0, startv, arrays); ERR;
-
-    // populate vertex arrays
+    // allocate a block of vertex handles for each diy block
+    // moab sequence allocation is not thread-safe, so this is serial
+    for (int lid = 0; lid < (int)master.size(); lid++)
+    {
+        MeshBlock* b = master.block<MeshBlock>(lid);
+        rval = iface->get_node_coords(3, b->num_verts, 0, b->startv, b->arrays); ERR;
+    }
+
+    // populate vertex arrays and handles of the vertices created by each block
     // vertices normalized to be in the range [0.0 - 1.0]
-    int n = 0;
-    for (int k = bounds[b].min[2]; k <= bounds[b].max[2]; k++)
+    master.foreach([&](MeshBlock* b, const diy::Master::ProxyWithLink&)
     {
-        for (int j = bounds[b].min[1]; j <= bounds[b].max[1]; j++)
+        const Bounds& bds = b->bounds;
+        int nx = bds.max[0] - bds.min[0] + 1;
+        b->vhandles.resize(nx * (bds.max[1] - bds.min[1] + 1) * (bds.max[2] - bds.min[2] + 1));
+        int r = 0;
+        for (int k = bds.min[2]; k <= bds.max[2]; k++)
         {
-            for (int i = bounds[b].min[0]; i <= bounds[b].max[0]; i++)
+            for (int j = bds.min[1]; j <= bds.max[1]; j++)
             {
-                arrays[0][n] = double(i) / (mesh_size[0] - 1);
-                arrays[1][n] = double(j) / (mesh_size[1] - 1);
-                arrays[2][n] = double(k) / (mesh_size[2] - 1);
-
-                // debug
-                // 	fprintf(stderr, "[i,j,k] = [%d %d %d] vert[%d] = [%.2lf %.2lf %.2lf]\n",
-                // 		i, j, k, n, arrays[0][n], arrays[1][n], arrays[2][n]);
-
-                n++;
+                int     lo  = b->rows.lo[r];
+                int     m   = b->rows.off[r] - lo;          // vertex index in sequence = m + i
+                int     n   = r * nx - bds.min[0];          // vertex index in bounds   = n + i
+                double  y   = double(j) / (mesh_size[1] - 1);
+                double  z   = double(k) / (mesh_size[2] - 1);
+                if (b->vorder.empty())
+                {
+                    for (int i = lo; i <= b->rows.hi[r]; i++)
+                    {
+                        b->arrays[0][m + i] = double(i) / (mesh_size[0] - 1);
+                        b->arrays[1][m + i] = y;
+                        b->arrays[2][m + i] = z;
+                        b->vhandles[n + i]  = b->startv + m + i;
+                    }
+                }
+                else
+                {
+                    for (int i = lo; i <= b->rows.hi[r]; i++)
+                    {
+                        int p = b->vorder[m + i];           // position along the space-filling curve
+                        b->arrays[0][p]     = double(i) / (mesh_size[0] - 1);
+                        b->arrays[1][p]     = y;
+                        b->arrays[2][p]     = z;
+                        b->vhandles[n + i]  = b->startv + p;
+                    }
+                }
+                r++;
             }
         }
-    }
-
-    // allocate connectivity array
-    EntityHandle startc;           // handle for start of cells
-    EntityHandle *starth;          // handle for start of connectivity
-    int num_hexes =
-        (bounds[b].max[0] - bounds[b].min[0]) *
-        (bounds[b].max[1] - bounds[b].min[1]) *
-        (bounds[b].max[2] - bounds[b].min[2]);
-    rval = iface->get_element_connect(num_hexes, 8, MBHEX, 0, startc, starth);
+    });
 
-    // populate the connectivity array
-    n = 0;
-    int m = 0;
-    for (int k = bounds[b].min[2]; k <= bounds[b].max[2]; k++)
+    // look up handles of the vertices created by other local blocks
+    master.foreach([&](MeshBlock* b, const diy::Master::ProxyWithLink&)
     {
-        for (int j = bounds[b].min[1]; j <= bounds[b].max[1]; j++)
+        int n = 0;
+        int r = 0;
+        for (int k = b->bounds.min[2]; k <= b->bounds.max[2]; k++)
         {
-            for (int i = bounds[b].min[0]; i <= bounds[b].max[0]; i++)
+            for (int j = b->bounds.min[1]; j <= b->bounds.max[1]; j++)
             {
-                if (i < bounds[b].max[0] && j < bounds[b].max[1] && k < bounds[b].max[2])
+                for (int i = b->bounds.min[0]; i <= b->bounds.max[0]; i++)
                 {
-                    int A, B, C, D, E, F, G, H; // hex verts according to my diagram
-                    D = n;
-                    C = D + 1;
-                    H = D + bounds[b].max[0] - bounds[b].min[0] + 1;
-                    G = H + 1;
-                    A = D + (bounds[b].max[0] - bounds[b].min[0] + 1) *
-                        (bounds[b].max[1] - bounds[b].min[1] + 1);
-                    B = A + 1;
-                    E = A + bounds[b].max[0] - bounds[b].min[0] + 1;
-                    F = E + 1;
-
-                    // hex ABCDEFGH
-                    starth[m++] = startv + A;
-                    starth[m++] = startv + B;
-                    starth[m++] = startv + C;
-                    starth[m++] = startv + D;
-                    starth[m++] = startv + E;
-                    starth[m++] = startv + F;
-                    starth[m++] = startv + G;
-                    starth[m++] = startv + H;
+                    if (i < b->rows.lo[r] || i > b->rows.hi[r])
+                    {
+                        int owner = vert_owner(master, b->lid, i, j, k);
+                        const Bounds& obds = master.block<MeshBlock>(owner)->bounds;
+                        int o = (i - obds.min[0]) +
+                            (j - obds.min[1]) * (obds.max[0] - obds.min[0] + 1) +
+                            (k - obds.min[2]) * (obds.max[0] - obds.min[0] + 1) * (obds.max[1] - obds.min[1] + 1);
+                        b->vhandles[n] = master.block<MeshBlock>(owner)->vhandles[o];
+                    }
+                    n++;
                 }
-                n++;
+                r++;
             }
         }
-    }
-
-    // add vertices and cells to the mesh set
-    Range vRange(startv, startv + num_verts - 1);      // vertex range
-    Range cRange(startc, startc + num_hexes - 1);      // cell range
-    rval = mbint->add_entities(*mesh_set, vRange); ERR;
-    rval = mbint->add_entities(*mesh_set, cRange); ERR;
+    });
+}
 
-    // check that long is indeed 8 bytes on this machine
-    assert(sizeof(long) == 8);
+// returns a pointer to the dense tag storage of the handles [start, start + num), allocating it if necessary
+// returns null if the handles are not contiguous in one moab sequence and need to be set with tag_set_data instead
+void* dense_tag_data(Interface *mbint,                          // moab interface instance
+        Tag tag,                                                // dense tag
+        EntityHandle start,                                     // first handle
+        int num)                                                // number of handles
+{
+    if (num <= 0)
+        return NULL;
 
-    // set global ids
-    long gid;
-    Tag global_id_tag;
-    rval = mbint->tag_get_handle("HANDLEID", sizeof(long), MB_TYPE_OPAQUE,
-            global_id_tag, MB_TAG_CREAT|MB_TAG_DENSE); ERR;
+    ErrorCode rval;
+    Range range(start, start + num - 1);
+    int count;
+    void* data;
+    rval = mbint->tag_iterate(tag, range.begin(), range.end(), count, data);
+    if (rval != MB_SUCCESS || count != num)
+        return NULL;
+    return data;
+}
 
-    // gids for vertices, starting at 1 by moab convention
-    handle = startv;
-    for (int k = bounds[b].min[2]; k < bounds[b].max[2] + 1; k++)
+// computes the global ids of the vertices of a block, starting at 1 by moab convention
+// gids holds one value for each vertex in rows, in the order of rows, or at position order[q] for the q-th vertex
+// in the order of rows if order is given
+void vert_gids_kernel(const int *mesh_size,                     // mesh size (i,j,k) number of vertices in each dim
+        const Bounds& bounds,                                   // block bounds
+        const VertRows& rows,                                   // vertices of the block
+        long *gids,                                             // (output) global ids
+        int threads,                                            // number of threads
+        const int *order)                                       // (optional) position of each vertex in gids
+{
+    int ny = bounds.max[1] - bounds.min[1] + 1;
+    parallel_for(rows.lo.size(), threads, [&](size_t begin, size_t end)
     {
-        for (int j = bounds[b].min[1]; j < bounds[b].max[1] + 1; j++)
+        for (size_t r = begin; r < end; r++)
         {
-            for (int i = bounds[b].min[0]; i < bounds[b].max[0] + 1; i++)
+            long j      = bounds.min[1] + r % ny;
+            long k      = bounds.min[2] + r / ny;
+            long first  = (long)1 + j * mesh_size[0] + k * mesh_size[0] * mesh_size[1];
+            int q       = rows.off[r] - rows.lo[r];
+            if (!order)
             {
-                gid = (long)1 + (long)i + (long)j * (mesh_size[0]) +
-                    (long)k * (mesh_size[0]) * (mesh_size[1]);
-//                 fprintf(stderr, "i,j,k = [%d %d %d] gid = %ld\n", i, j, k, gid);
-                rval = mbint->tag_set_data(global_id_tag, &handle, 1, &gid); ERR;
-                handle++;
+                long* row = gids + q;
+                for (int i = rows.lo[r]; i <= rows.hi[r]; i++)
+                    row[i] = first + i;
+            }
+            else
+            {
+                for (int i = rows.lo[r]; i <= rows.hi[r]; i++)
+                    gids[order[q + i]] = first + i;
             }
         }
-    }
+    });
+}
 
-    // gids for cells, starting at 1 by moab convention
-    handle = startc;
-    for (int k = bounds[b].min[2]; k < bounds[b].max[2]; k++)
+// computes the global ids of the cells of a block, starting at 1 by moab convention
+// cells_per_space cells (1 for hexes, 6 for tets) are created for each grid space, in i-j-k order of the grid spaces,
+// or with the cells of the s-th grid space in i-j-k order at position order[s] if order is given
+void cell_gids_kernel(const int *mesh_size,                     // mesh size (i,j,k) number of vertices in each dim
+        const Bounds& bounds,                                   // block bounds
+        int cells_per_space,                                    // number of cells per grid space
+        long *gids,                                             // (output) global ids
+        int threads,                                            // number of threads
+        const int *order)                                       // (optional) position of each grid space in gids
+{
+    long nx     = mesh_size[0] - 1;                             // grid spaces in the global mesh
+    long ny     = mesh_size[1] - 1;
+    int  bnx    = bounds.max[0] - bounds.min[0];                // grid spaces in the block
+    int  bny    = bounds.max[1] - bounds.min[1];
+    int  bnz    = bounds.max[2] - bounds.min[2];
+    int  len    = bnx * cells_per_space;                        // cells in one row of the block
+
+    // the cells in a row have consecutive global ids
+    parallel_for((size_t)bny * bnz, threads, [&](size_t begin, size_t end)
     {
-        for (int j = bounds[b].min[1]; j < bounds[b].max[1]; j++)
+        for (size_t r = begin; r < end; r++)
         {
-            for (int i = bounds[b].min[0]; i < bounds[b].max[0]; i++)
+            long j      = bounds.min[1] + r % bny;
+            long k      = bounds.min[2] + r / bny;
+            long first  = (long)1 + cells_per_space * (bounds.min[0] + j * nx + k * nx * ny);
+            if (!order)
+            {
+                long* row = gids + r * len;
+                for (int q = 0; q < len; q++)
+                    row[q] = first + q;
+            }
+            else
             {
-                gid = (long)1 + (long)i + (long)j * (mesh_size[0] - 1) +
-                    (long)k * (mesh_size[0] - 1) * (mesh_size[1] - 1);
-//                 fprintf(stderr, "i,j,k = [%d %d %d] gid = %ld\n", i, j, k, gid);
-                rval = mbint->tag_set_data(global_id_tag, &handle, 1, &gid); ERR;
-                handle++;
+                const int* row_order = order + r * bnx;
+                for (int q = 0; q < len; q++)
+                    gids[(long)cells_per_space * row_order[q / cells_per_space] + q % cells_per_space] = first + q;
             }
         }
-    }
+    });
+}
+
+// set global ids of the vertices and cells of the local blocks
+// the ids are written in bulk to the dense tag storage of each block's vertex and cell sequences
+static void set_block_gids(int *mesh_size,                      // mesh size (i,j,k) number of vertices in each dim
+        Interface *mbint,                                       // moab interface instance
+        Tag global_id_tag,                                      // global id tag
+        int cells_per_space,                                    // number of cells per grid space
+        diy::Master& master)                                    // diy master
+{
+    ErrorCode rval;
+    vector<long> tmp;
+
+    for (int lid = 0; lid < (int)master.size(); lid++)
+    {
+        MeshBlock* b = master.block<MeshBlock>(lid);
+
+        // gids for vertices
+        long* gids = (long*)dense_tag_data(mbint, global_id_tag, b->startv, b->num_verts);
+        bool bulk = gids != NULL;
+        if (!bulk)
+        {
+            tmp.resize(b->num_verts);
+            gids = &tmp[0];
+        }
+        vert_gids_kernel(mesh_size, b->bounds, b->rows, gids, master.threads(),
+                b->vorder.empty() ? NULL : &b->vorder[0]);
+        if (!bulk)
+        {
+            Range vRange(b->startv, b->startv + b->num_verts - 1);
+            rval = mbint->tag_set_data(global_id_tag, vRange, gids); ERR;
+        }
 
-    // Create a part set to add entities in the current block
-    // Technically we could have an array of these to represent multiple
-    // blocks in the current process - but we will simplify this assumption
-    EntityHandle partset;
-    rval = mbint->create_meshset(MESHSET_SET, partset); ERR;
-    rval = mbint->add_entities(partset, cRange); ERR;
+        // gids for cells
+        gids = (long*)dense_tag_data(mbint, global_id_tag, b->startc, b->num_cells);
+        bulk = gids != NULL;
+        if (!bulk)
+        {
+            tmp.resize(b->num_cells);
+            gids = &tmp[0];
+        }
+        cell_gids_kernel(mesh_size, b->bounds, cells_per_space, gids, master.threads(),
+                b->corder.empty() ? NULL : &b->corder[0]);
+        if (!bulk)
+        {
+            Range cRange(b->startc, b->startc + b->num_cells - 1);
+            rval = mbint->tag_set_data(global_id_tag, cRange, gids); ERR;
+        }
+    }
+}
 
+// add vertices and cells of the local blocks to the mesh set, and create one part set per block
+// ghost cells are in the mesh set but not in the part set
+static void add_block_sets(Interface *mbint,                    // moab interface instance
+        EntityHandle *mesh_set,                                 // moab mesh set
+        ParallelComm *mbpc,                                     // moab communicator
+        diy::Master& master,                                    // diy master
+        int cells_per_space)                                    // number of cells per grid space
+{
+    ErrorCode rval;
     Tag parttag;
-    int dumid=-1, proc_id=mbpc->rank();
+    int dumid = -1;
     rval = mbint->tag_get_handle("PARALLEL_PARTITION", 1, MB_TYPE_INTEGER, parttag, MB_TAG_CREAT | MB_TAG_SPARSE, &dumid); ERR;
-    rval = mbint->tag_set_data(parttag, &partset, 1, &proc_id); ERR;
-    rval = mbint->add_entities(*mesh_set, &partset, 1); ERR;
 
     Range psets;
-    psets.insert(partset);
+    for (int lid = 0; lid < (int)master.size(); lid++)
+    {
+        MeshBlock* b = master.block<MeshBlock>(lid);
+
+        // add vertices and cells to the mesh set
+        Range vRange(b->startv, b->startv + b->num_verts - 1);     // vertex range
+        Range cRange(b->startc, b->startc + b->num_cells - 1);     // cell range
+        rval = mbint->add_entities(*mesh_set, vRange); ERR;
+        rval = mbint->add_entities(*mesh_set, cRange); ERR;
+
+        // cells owned by the block, ie, not in its ghost layers
+        Range oRange;
+        if (b->core.min == b->bounds.min && b->core.max == b->bounds.max)
+            oRange = cRange;
+        else
+        {
+            const Bounds& cbds = b->core;
+            for (int k = cbds.min[2]; k < cbds.max[2]; k++)
+                for (int j = cbds.min[1]; j < cbds.max[1]; j++)
+                    for (int i = cbds.min[0]; i < cbds.max[0]; i++)
+                        for (int t = 0; t < cells_per_space; t++)
+                            oRange.insert(cell_handle(b, cells_per_space, i, j, k, t));
+        }
+
+        // create a part set with the cells in the current block, tagged with the block gid
+        EntityHandle partset;
+        rval = mbint->create_meshset(MESHSET_SET, partset); ERR;
+        rval = mbint->add_entities(partset, oRange); ERR;
+        rval = mbint->tag_set_data(parttag, &partset, 1, &b->gid); ERR;
+        rval = mbint->add_entities(*mesh_set, &partset, 1); ERR;
+        psets.insert(partset);
+    }
     mbpc->partition_sets() = psets;
+}
+
+// create hex cells and vertices
+void create_hexes_and_verts(int *mesh_size,     // mesh size (i,j,k) number of vertices in each dim
+        Interface *mbint,                       // moab interface instance
+        EntityHandle *mesh_set,                 // moab mesh set
+        diy::Master& master,                    // diy master with the local blocks
+        ParallelComm *mbpc,                     // moab communicator
+        int order)                              // vertex and cell order (0 = i-j-k, 1 = Morton, 2 = Hilbert)
+{
+    ErrorCode rval;
+
+    // get the read interface from moab
+    ReadUtilIface *iface;
+    rval = mbint->query_interface(iface); ERR;
+
+    // vertices
+    create_block_verts(mesh_size, iface, master, order);
+
+    // allocate connectivity arrays
+    for (int lid = 0; lid < (int)master.size(); lid++)
+    {
+        MeshBlock* b = master.block<MeshBlock>(lid);
+        b->num_cells =
+            (b->bounds.max[0] - b->bounds.min[0]) *
+            (b->bounds.max[1] - b->bounds.min[1]) *
+            (b->bounds.max[2] - b->bounds.min[2]);
+        rval = iface->get_element_connect(b->num_cells, 8, MBHEX, 0, b->startc, b->starth); ERR;
+    }
+
+    // populate the connectivity arrays
+    // the cells of each grid space are placed in the connectivity array at the position of the space in the block order
+    master.foreach([&](MeshBlock* b, const diy::Master::ProxyWithLink&)
+    {
+        order_block_cells(b, order);
+        const Bounds& bds = b->bounds;
+        int n = 0;
+        int sp = 0;                             // grid space in i-j-k order
+        for (int k = bds.min[2]; k <= bds.max[2]; k++)
+        {
+            for (int j = bds.min[1]; j <= bds.max[1]; j++)
+            {
+                for (int i = bds.min[0]; i <= bds.max[0]; i++)
+                {
+                    if (i < bds.max[0] && j < bds.max[1] && k < bds.max[2])
+                    {
+                        int m = 8 * (b->corder.empty() ? sp : b->corder[sp]);
+                        sp++;
+
+                        int A, B, C, D, E, F, G, H; // hex verts according to my diagram
+                        D = n;
+                        C = D + 1;
+                        H = D + bds.max[0] - bds.min[0] + 1;
+                        G = H + 1;
+                        A = D + (bds.max[0] - bds.min[0] + 1) *
+                            (bds.max[1] - bds.min[1] + 1);
+                        B = A + 1;
+                        E = A + bds.max[0] - bds.min[0] + 1;
+                        F = E + 1;
+
+                        // hex ABCDEFGH
+                        b->starth[m++] = b->vhandles[A];
+                        b->starth[m++] = b->vhandles[B];
+                        b->starth[m++] = b->vhandles[C];
+                        b->starth[m++] = b->vhandles[D];
+                        b->starth[m++] = b->vhandles[E];
+                        b->starth[m++] = b->vhandles[F];
+                        b->starth[m++] = b->vhandles[G];
+                        b->starth[m++] = b->vhandles[H];
+                    }
+                    n++;
+                }
+            }
+        }
+    });
+
+    // check that long is indeed 8 bytes on this machine
+    assert(sizeof(long) == 8);
+
+    // set global ids
+    Tag global_id_tag;
+    rval = mbint->tag_get_handle("HANDLEID", sizeof(long), MB_TYPE_OPAQUE,
+            global_id_tag, MB_TAG_CREAT|MB_TAG_DENSE); ERR;
+    set_block_gids(mesh_size, mbint, global_id_tag, 1, master);
+
+    // add entities to the mesh set and create one part set per block
+    add_block_sets(mbint, mesh_set, mbpc, master, 1);
 
     // update adjacencies (needed by moab)
-    rval = iface->update_adjacencies(startc, num_hexes, 8, starth); ERR;
+    for (int lid = 0; lid < (int)master.size(); lid++)
+    {
+        MeshBlock* b = master.block<MeshBlock>(lid);
+        rval = iface->update_adjacencies(b->startc, b->num_cells, 8, b->starth); ERR;
+    }
 
     // cleanup
     rval = mbint->release_interface(iface); ERR;
@@ -218,479 +628,1753 @@ void create_hexes_and_verts(int *mesh_size,     // mesh size (i,j,k) number of v
 void create_tets_and_verts(int *mesh_size,      // mesh size (i,j,k) number of vertices in each dim
         Interface *mbint,                       // moab interface instance
         EntityHandle *mesh_set,                 // moab parallel communicator
-        diy::RegularDecomposer<Bounds>& decomp, // diy decomposition
-        diy::RoundRobinAssigner& assign,        // diy assignment
-        ParallelComm *mbpc)                     // moab communicator
+        diy::Master& master,                    // diy master with the local blocks
+        ParallelComm *mbpc,                     // moab communicator
+        int order)                              // vertex and cell order (0 = i-j-k, 1 = Morton, 2 = Hilbert)
 {
-    Core *mbcore = dynamic_cast<Core*>(mbint);
-    EntityHandle vs, cs;
     ErrorCode rval;
-    EntityHandle handle;
-    vector<int> local_gids;
-    int rank;
-    MPI_Comm_rank(mbpc->comm(), &rank);
-    assign.local_gids(rank, local_gids);
-    int nblocks = local_gids.size();
-    std::vector<Bounds> bounds;
-    for (auto i = 0; i < nblocks; i++)
-        bounds.push_back(3);
-    int b;                                   // local block number
+
+    // debug
+    //     fprintf(stderr, "nblocks = %d\n", (int)master.size());
 
     // get the read interface from moab
     ReadUtilIface *iface;
     rval = mbint->query_interface(iface); ERR;
 
-    // block bounds
-    for (int b = 0; b < nblocks; b++)
-        decomp.fill_bounds(bounds[b], local_gids[b], false);
+    // vertices
+    create_block_verts(mesh_size, iface, master, order);
 
-    // debug
-    //     fprintf(stderr, "nblocks = %d\n", nblocks);
-    //     fprintf(stderr, "bounds min = [%d %d %d] max = [%d %d %d]\n",
-    //             bounds[0].min[0], bounds[0].min[1], bounds[0].min[2],
-    //             bounds[0].max[0], bounds[0].max[1], bounds[0].max[2]);
-
-    // todo: multiple blocks per process not really supported yet in this example
-    b = 0;
-
-    // the following method is based on the example in
-    // moab/examples/old/FileRead.cpp, using the ReadUtilIface class
-
-    // allocate a block of vertex handles and store xyz’s into them
-    // returns a starting handle for the node sequence
-    vector<double*> arrays;
-    EntityHandle startv;
-    int num_verts =
-        (bounds[b].max[0] - bounds[b].min[0] + 1) *
-        (bounds[b].max[1] - bounds[b].min[1] + 1) *
-        (bounds[b].max[2] - bounds[b].min[2] + 1);
-    rval = iface->get_node_coords(3, num_verts, 0, startv, arrays); ERR;
-
-    // populate vertex arrays
-    // vertices normalized to be in the range [0.0 - 1.0]
-    int n = 0;
-    for(int k = bounds[b].min[2]; k <= bounds[b].max[2]; k++)
+    // allocate connectivity arrays
+    for (int lid = 0; lid < (int)master.size(); lid++)
     {
-        for(int j = bounds[b].min[1]; j <= bounds[b].max[1]; j++)
-        {
-            for(int i = bounds[b].min[0]; i <= bounds[b].max[0]; i++)
-            {
-                arrays[0][n] = double(i) / (mesh_size[0] - 1);
-                arrays[1][n] = double(j) / (mesh_size[1] - 1);
-                arrays[2][n] = double(k) / (mesh_size[2] - 1);
-
-                // debug
-                //                 fprintf(stderr, "vert[%d] = [%.2lf %.2lf %.2lf]\n",
-                //                         n, arrays[0][n], arrays[1][n], arrays[2][n]);
-                n++;
-            }
-        }
+        MeshBlock* b = master.block<MeshBlock>(lid);
+        b->num_cells = 6 *                      // each hex cell will be converted to 6 tets
+            (b->bounds.max[0] - b->bounds.min[0]) *
+            (b->bounds.max[1] - b->bounds.min[1]) *
+            (b->bounds.max[2] - b->bounds.min[2]);
+        rval = iface->get_element_connect(b->num_cells, 4, MBTET, 0, b->startc, b->starth); ERR;
     }
 
-    // allocate connectivity array
-    EntityHandle startc;                          // handle for start of cells
-    EntityHandle *starth;                         // handle for start of connectivity
-    int num_tets = 6 *                            // each hex cell will be converted to 6 tets
-        (bounds[b].max[0] - bounds[b].min[0]) *
-        (bounds[b].max[1] - bounds[b].min[1]) *
-        (bounds[b].max[2] - bounds[b].min[2]);
-    rval = iface->get_element_connect(num_tets, 4, MBTET, 0, startc, starth); ERR;
-
-    // populate the connectivity array
-    n = 0;
-    int m = 0;
-    for (int k = bounds[b].min[2]; k <= bounds[b].max[2]; k++)
+    // populate the connectivity arrays
+    // the cells of each grid space are placed in the connectivity array at the position of the space in the block order
+    master.foreach([&](MeshBlock* b, const diy::Master::ProxyWithLink&)
     {
-        for (int j = bounds[b].min[1]; j <= bounds[b].max[1]; j++)
+        order_block_cells(b, order);
+        const Bounds& bds = b->bounds;
+        int n = 0;
+        int sp = 0;                             // grid space in i-j-k order
+        for (int k = bds.min[2]; k <= bds.max[2]; k++)
         {
-            for (int i = bounds[b].min[0]; i <= bounds[b].max[0]; i++)
+            for (int j = bds.min[1]; j <= bds.max[1]; j++)
             {
-                if (i < bounds[b].max[0] && j < bounds[b].max[1] &&
-                        k < bounds[b].max[2])
+                for (int i = bds.min[0]; i <= bds.max[0]; i++)
                 {
-                    int A, B, C, D, E, F, G, H;   // hex verts according to my diagram
-                    D = n;
-                    C = D + 1;
-                    H = D + bounds[b].max[0] - bounds[b].min[0] + 1;
-                    G = H + 1;
-                    A = D + (bounds[b].max[0] - bounds[b].min[0] + 1) *
-                        (bounds[b].max[1] - bounds[b].min[1] + 1);
-                    B = A + 1;
-                    E = A + bounds[b].max[0] - bounds[b].min[0] + 1;
-                    F = E + 1;
-
-                    // tet EDHG
-                    starth[m++] = startv + E;
-                    starth[m++] = startv + D;
-                    starth[m++] = startv + H;
-                    starth[m++] = startv + G;
-
-                    // tet ABCF
-                    starth[m++] = startv + A;
-                    starth[m++] = startv + B;
-                    starth[m++] = startv + C;
-                    starth[m++] = startv + F;
-
-                    // tet ADEF
-                    starth[m++] = startv + A;
-                    starth[m++] = startv + D;
-                    starth[m++] = startv + E;
-                    starth[m++] = startv + F;
-
-                    // tet CGDF
-                    starth[m++] = startv + C;
-                    starth[m++] = startv + G;
-                    starth[m++] = startv + D;
-                    starth[m++] = startv + F;
-
-                    // tet ACDF
-                    starth[m++] = startv + A;
-                    starth[m++] = startv + C;
-                    starth[m++] = startv + D;
-                    starth[m++] = startv + F;
-
-                    // tet DGEF
-                    starth[m++] = startv + D;
-                    starth[m++] = startv + G;
-                    starth[m++] = startv + E;
-                    starth[m++] = startv + F;
+                    if (i < bds.max[0] && j < bds.max[1] && k < bds.max[2])
+                    {
+                        int m = 24 * (b->corder.empty() ? sp : b->corder[sp]);
+                        sp++;
+
+                        int A, B, C, D, E, F, G, H;   // hex verts according to my diagram
+                        D = n;
+                        C = D + 1;
+                        H = D + bds.max[0] - bds.min[0] + 1;
+                        G = H + 1;
+                        A = D + (bds.max[0] - bds.min[0] + 1) *
+                            (bds.max[1] - bds.min[1] + 1);
+                        B = A + 1;
+                        E = A + bds.max[0] - bds.min[0] + 1;
+                        F = E + 1;
+
+                        // tet EDHG
+                        b->starth[m++] = b->vhandles[E];
+                        b->starth[m++] = b->vhandles[D];
+                        b->starth[m++] = b->vhandles[H];
+                        b->starth[m++] = b->vhandles[G];
+
+                        // tet ABCF
+                        b->starth[m++] = b->vhandles[A];
+                        b->starth[m++] = b->vhandles[B];
+                        b->starth[m++] = b->vhandles[C];
+                        b->starth[m++] = b->vhandles[F];
+
+                        // tet ADEF
+                        b->starth[m++] = b->vhandles[A];
+                        b->starth[m++] = b->vhandles[D];
+                        b->starth[m++] = b->vhandles[E];
+                        b->starth[m++] = b->vhandles[F];
+
+                        // tet CGDF
+                        b->starth[m++] = b->vhandles[C];
+                        b->starth[m++] = b->vhandles[G];
+                        b->starth[m++] = b->vhandles[D];
+                        b->starth[m++] = b->vhandles[F];
+
+                        // tet ACDF
+                        b->starth[m++] = b->vhandles[A];
+                        b->starth[m++] = b->vhandles[C];
+                        b->starth[m++] = b->vhandles[D];
+                        b->starth[m++] = b->vhandles[F];
+
+                        // tet DGEF
+                        b->starth[m++] = b->vhandles[D];
+                        b->starth[m++] = b->vhandles[G];
+                        b->starth[m++] = b->vhandles[E];
+                        b->starth[m++] = b->vhandles[F];
+                    }
+                    n++;
                 }
-                n++;
             }
         }
-    }
-
-    // add vertices and cells to the mesh set
-    Range vRange(startv, startv + num_verts - 1);      // vertex range
-    Range cRange(startc, startc + num_tets - 1);       // cell range
-    rval = mbint->add_entities(*mesh_set, vRange); ERR;
-    rval = mbint->add_entities(*mesh_set, cRange); ERR;
+    });
 
     // set global ids
-    long gid;
     Tag global_id_tag;
     rval = mbint->tag_get_handle("HANDLEID", sizeof(long), MB_TYPE_OPAQUE,
             global_id_tag, MB_TAG_CREAT|MB_TAG_DENSE); ERR;
+    set_block_gids(mesh_size, mbint, global_id_tag, 6, master);
 
-    // gids for vertices, starting at 1 by moab convention
-    handle = startv;
-    for (int k = bounds[b].min[2]; k < bounds[b].max[2] + 1; k++)
+    // update adjacencies (needed by moab)
+    for (int lid = 0; lid < (int)master.size(); lid++)
     {
-        for (int j = bounds[b].min[1]; j < bounds[b].max[1] + 1; j++)
-        {
-            for (int i = bounds[b].min[0]; i < bounds[b].max[0] + 1; i++)
-            {
-                gid = (long)1 + (long)i + (long)j * (mesh_size[0]) +
-                    (long)k * (mesh_size[0]) * (mesh_size[1]);
-                // debug
-                //                 fprintf(stderr, "i,j,k = [%d %d %d] gid = %ld\n", i, j, k, gid);
-                rval = mbint->tag_set_data(global_id_tag, &handle, 1, &gid); ERR;
-                handle++;
-            }
-        }
+        MeshBlock* b = master.block<MeshBlock>(lid);
+        rval = iface->update_adjacencies(b->startc, b->num_cells, 4, b->starth); ERR;
+    }
+
+    // add entities to the mesh set and create one part set per block
+    add_block_sets(mbint, mesh_set, mbpc, master, 6);
+
+    // cleanup
+    rval = mbint->release_interface(iface); ERR;
+}
+
+// create hex cells and vertices as structured boxes through ScdInterface
+// one box per local block; the connectivity is implicit in the structured element sequence, and no
+// adjacencies need to be updated, but vertices on faces shared by local blocks cannot be stitched,
+// so this supports one block per process
+void create_scd_hexes_and_verts(int *mesh_size, // mesh size (i,j,k) number of vertices in each dim
+        Interface *mbint,                       // moab interface instance
+        EntityHandle *mesh_set,                 // moab mesh set
+        diy::Master& master,                    // diy master with the local blocks
+        ParallelComm *mbpc)                     // moab communicator
+{
+    ErrorCode rval;
+
+    // get the structured mesh interface from moab
+    ScdInterface *scdi;
+    rval = mbint->query_interface(scdi); ERR;
+
+    // construct one box per block
+    // moab sequence allocation is not thread-safe, so this is serial
+    for (int lid = 0; lid < (int)master.size(); lid++)
+    {
+        MeshBlock* b = master.block<MeshBlock>(lid);
+        const Bounds& bds = b->bounds;
+        ScdBox* box;
+        rval = scdi->construct_box(HomCoord(bds.min[0], bds.min[1], bds.min[2]),
+                HomCoord(bds.max[0], bds.max[1], bds.max[2]), NULL, 0, box); ERR;
+        b->startv       = box->start_vertex();
+        b->num_verts    = box->num_vertices();
+        b->startc       = box->start_element();
+        b->num_cells    = box->num_elements();
+
+        // coordinate arrays of the box vertices
+        Range vRange(b->startv, b->startv + b->num_verts - 1);
+        double *x, *y, *z;
+        int count;
+        rval = mbint->coords_iterate(vRange.begin(), vRange.end(), x, y, z, count); ERR;
+        assert(count == b->num_verts);
+        b->arrays.assign({x, y, z});
     }
 
-    // gids for cells, starting at 1 by moab convention
-    handle = startc;
-    for (int k = bounds[b].min[2]; k < bounds[b].max[2]; k++)
+    // populate vertex arrays; the box has all vertices in the bounds, in i-j-k order
+    // vertices normalized to be in the range [0.0 - 1.0]
+    master.foreach([&](MeshBlock* b, const diy::Master::ProxyWithLink&)
     {
-        for (int j = bounds[b].min[1]; j < bounds[b].max[1]; j++)
+        const Bounds& bds = b->bounds;
+        int nrows = (bds.max[1] - bds.min[1] + 1) * (bds.max[2] - bds.min[2] + 1);
+        b->rows.lo.assign(nrows, bds.min[0]);
+        b->rows.hi.assign(nrows, bds.max[0]);
+        b->rows.off.resize(nrows);
+        b->vhandles.resize(b->num_verts);
+        int n = 0;
+        int r = 0;
+        for (int k = bds.min[2]; k <= bds.max[2]; k++)
         {
-            for (int i = bounds[b].min[0]; i < bounds[b].max[0]; i++)
+            for (int j = bds.min[1]; j <= bds.max[1]; j++)
             {
-                for (int t = 0; t < 6; t++)            // 6 tets per grid space
+                b->rows.off[r++] = n;
+                for (int i = bds.min[0]; i <= bds.max[0]; i++)
                 {
-                    gid = (long)1 + (long)t +  (long)i * 6 + (long)j * 6 * (mesh_size[0] - 1) +
-                        (long)k * 6 * (mesh_size[0] - 1) * (mesh_size[1] - 1);
-                    // 	 fprintf(stderr, "t,i,j,k = [%d %d %d %d] gid = %ld\n", t, i, j, k, gid);
-                    rval = mbint->tag_set_data(global_id_tag, &handle, 1, &gid); ERR;
-                    handle++;
+                    b->arrays[0][n] = double(i) / (mesh_size[0] - 1);
+                    b->arrays[1][n] = double(j) / (mesh_size[1] - 1);
+                    b->arrays[2][n] = double(k) / (mesh_size[2] - 1);
+                    b->vhandles[n]  = b->startv + n;
+                    n++;
                 }
             }
         }
-    }
+        assert(n == b->num_verts);
+    });
 
-    // update adjacencies (needed by moab)
-    rval = iface->update_adjacencies(startc, num_tets, 4, starth); ERR;
+    // set global ids
+    Tag global_id_tag;
+    rval = mbint->tag_get_handle("HANDLEID", sizeof(long), MB_TYPE_OPAQUE,
+            global_id_tag, MB_TAG_CREAT|MB_TAG_DENSE); ERR;
+    set_block_gids(mesh_size, mbint, global_id_tag, 1, master);
 
-    // Create a part set to add entities in the current block
-    // Technically we could have an array of these to represent multiple
-    // blocks in the current process - but we will simplify this assumption
-    EntityHandle partset;
-    rval = mbint->create_meshset(MESHSET_SET, partset); ERR;
-    rval = mbint->add_entities(partset, cRange); ERR;
+    // add entities to the mesh set and create one part set per block
+    add_block_sets(mbint, mesh_set, mbpc, master, 1);
 
-    Tag parttag;
-    int dumid=-1, proc_id=mbpc->rank();
-    rval = mbint->tag_get_handle("PARALLEL_PARTITION", 1, MB_TYPE_INTEGER, parttag, MB_TAG_CREAT | MB_TAG_SPARSE, &dumid); ERR;
-    rval = mbint->tag_set_data(parttag, &partset, 1, &proc_id); ERR;
-    rval = mbint->add_entities(*mesh_set, &partset, 1); ERR;
+    // cleanup
+    rval = mbint->release_interface(scdi); ERR;
+}
 
-    Range psets;
-    psets.insert(partset);
-    mbpc->partition_sets() = psets;
+// generate a regular structured hex mesh
+void hex_mesh_gen(int *mesh_size,                       // mesh size (i,j,k) number of vertices in each dim
+        Interface *mbint,                               // moab interface instance
+        EntityHandle *mesh_set,                         // moab mesh set
+        ParallelComm *mbpc,                             // moab parallel communicator
+        diy::RegularDecomposer<Bounds>& decomp,         // diy decomposition
+        diy::RoundRobinAssigner& assign,                // diy assignment
+        const TaskParams& params)                       // task parameters
+{
+    // local blocks, generated concurrently by diy
+    PhaseTimer generate(params.timers, PHASE_GENERATE);
+    diy::Master master(mbpc->comm(), params.threads, -1, &MeshBlock::create, &MeshBlock::destroy);
+    init_blocks(master, decomp, assign, mbpc->rank());
+
+    create_hexes_and_verts(mesh_size, mbint, mesh_set, master, mbpc, params.order);
+    generate.stop();
+
+    PhaseTimer resolve(params.timers, PHASE_RESOLVE);
+    if (params.ghost > 0)
+        resolve_ghosts_from_decomposition(1, mbint, mesh_set, mbpc, decomp, assign, master);
+    else if (params.resolve == 0)
+        resolve_and_exchange(mbint, mesh_set, mbpc);
+    else
+        resolve_from_decomposition(mesh_size, mbint, mesh_set, mbpc, decomp, assign, master);
+    resolve.stop();
 
-    // cleanup
-    rval = mbint->release_interface(iface); ERR;
+    if (params.resolve == 2 && params.ghost == 0)
+        validate_resolve(mesh_size, 0, mbint, mbpc, decomp, assign, params);
+}
+
+// generate a regular structured tet mesh
+void tet_mesh_gen(int *mesh_size,                        // mesh size (i,j,k) number of vertices in each dim
+        Interface *mbint,                                // moab interface instance
+        EntityHandle *mesh_set,                          // moab mesh set
+        ParallelComm *mbpc,                              // moab parallel communicator
+        diy::RegularDecomposer<Bounds>& decomp,          // diy decomposition
+        diy::RoundRobinAssigner& assign,                 // diy assignment
+        const TaskParams& params)                        // task parameters
+{
+    // local blocks, generated concurrently by diy
+    PhaseTimer generate(params.timers, PHASE_GENERATE);
+    diy::Master master(mbpc->comm(), params.threads, -1, &MeshBlock::create, &MeshBlock::destroy);
+    init_blocks(master, decomp, assign, mbpc->rank());
+
+    create_tets_and_verts(mesh_size, mbint, mesh_set, master, mbpc, params.order);
+    generate.stop();
+
+    PhaseTimer resolve(params.timers, PHASE_RESOLVE);
+    if (params.ghost > 0)
+        resolve_ghosts_from_decomposition(6, mbint, mesh_set, mbpc, decomp, assign, master);
+    else if (params.resolve == 0)
+        resolve_and_exchange(mbint, mesh_set, mbpc);
+    else
+        resolve_from_decomposition(mesh_size, mbint, mesh_set, mbpc, decomp, assign, master);
+    resolve.stop();
+
+    if (params.resolve == 2 && params.ghost == 0)
+        validate_resolve(mesh_size, 1, mbint, mbpc, decomp, assign, params);
+}
+
+// generate a regular structured hex mesh with implicit connectivity
+void scd_mesh_gen(int *mesh_size,                        // mesh size (i,j,k) number of vertices in each dim
+        Interface *mbint,                                // moab interface instance
+        EntityHandle *mesh_set,                          // moab mesh set
+        ParallelComm *mbpc,                              // moab parallel communicator
+        diy::RegularDecomposer<Bounds>& decomp,          // diy decomposition
+        diy::RoundRobinAssigner& assign,                 // diy assignment
+        const TaskParams& params)                        // task parameters
+{
+    // local blocks, generated concurrently by diy
+    PhaseTimer generate(params.timers, PHASE_GENERATE);
+    diy::Master master(mbpc->comm(), params.threads, -1, &MeshBlock::create, &MeshBlock::destroy);
+    init_blocks(master, decomp, assign, mbpc->rank());
+
+    create_scd_hexes_and_verts(mesh_size, mbint, mesh_set, master, mbpc);
+    generate.stop();
+
+    PhaseTimer resolve(params.timers, PHASE_RESOLVE);
+    if (params.ghost > 0)
+        resolve_ghosts_from_decomposition(1, mbint, mesh_set, mbpc, decomp, assign, master);
+    else if (params.resolve == 0)
+        resolve_and_exchange(mbint, mesh_set, mbpc);
+    else
+        resolve_from_decomposition(mesh_size, mbint, mesh_set, mbpc, decomp, assign, master);
+    resolve.stop();
 
+    if (params.resolve == 2 && params.ghost == 0)
+        validate_resolve(mesh_size, 2, mbint, mbpc, decomp, assign, params);
+}
+
+// generates the vertices and cells of the local blocks, without resolving shared entities
+void create_mesh(int mesh_type,                         // mesh type (0 = hex, 1 = tet, 2 = structured hex)
+        int *mesh_size,                                 // mesh size (i,j,k) number of vertices in each dim
+        Interface *mbint,                               // moab interface instance
+        EntityHandle *mesh_set,                         // moab mesh set
+        ParallelComm *mbpc,                             // moab parallel communicator
+        diy::RegularDecomposer<Bounds>& decomp,         // diy decomposition
+        diy::RoundRobinAssigner& assign,                // diy assignment
+        const TaskParams& params)                       // task parameters
+{
+    diy::Master master(mbpc->comm(), params.threads, -1, &MeshBlock::create, &MeshBlock::destroy);
+    init_blocks(master, decomp, assign, mbpc->rank());
+    if (mesh_type == 0)
+        create_hexes_and_verts(mesh_size, mbint, mesh_set, master, mbpc, params.order);
+    else if (mesh_type == 1)
+        create_tets_and_verts(mesh_size, mbint, mesh_set, master, mbpc, params.order);
+    else
+        create_scd_hexes_and_verts(mesh_size, mbint, mesh_set, master, mbpc);
 }
 
 // resolve shared entities
 void resolve_and_exchange(Interface *mbint,       // mbint: moab interface instance
         EntityHandle *mesh_set, // mesh_set: moab mesh set
         ParallelComm *mbpc)     // mbpc: moab parallel communicator
+{
+    mbpc->partition_sets().insert(*mesh_set);
+    resolve_by_gids(mbint, mesh_set, mbpc);
+}
+
+// resolve shared entities by their HANDLEID global ids, leaving the partition sets as they are
+void resolve_by_gids(Interface *mbint,          // mbint: moab interface instance
+        EntityHandle *mesh_set, // mesh_set: moab mesh set
+        ParallelComm *mbpc)     // mbpc: moab parallel communicator
 {
     ErrorCode rval;
 
-    mbpc->partition_sets().insert(*mesh_set);
     Tag global_id_tag;
     rval = mbint->tag_get_handle("HANDLEID", sizeof(long), MB_TYPE_OPAQUE, global_id_tag, MB_TAG_DENSE); ERR;
     rval = mbpc->resolve_shared_ents(*mesh_set, -1, -1, &global_id_tag); ERR;
 }
 
-// return a value for the field position (simple magnitude)
-double PhysField(double x,
-        double y,
-        double z,
-        double factor)
+// resolve shared entities directly from the decomposition, bypassing resolve_shared_ents
+// the vertices on block faces shared with other ranks, and those ranks, follow from the regular decomposition,
+// so the only skin computed is that of the layer of cells touching those vertices, and the only communication is
+// one exchange of vertex handles with each neighboring rank, plus the exchange of face and edge handles
+// that resolve_shared_ents also does
+void resolve_from_decomposition(int *mesh_size,         // mesh size (i,j,k) number of vertices in each dim
+        Interface *mbint,                               // moab interface instance
+        EntityHandle *mesh_set,                         // moab mesh set
+        ParallelComm *mbpc,                             // moab parallel communicator
+        diy::RegularDecomposer<Bounds>& decomp,         // diy decomposition
+        diy::RoundRobinAssigner& assign,                // diy assignment
+        diy::Master& master)                            // diy master with the generated local blocks
 {
-    return factor * sqrt(x * x + y * y + z * z);
-}
+    ErrorCode rval;
+    int rank = mbpc->rank();
 
-// add a value to each element in the field
-void PutElementField(Interface *mbi,
+    mbpc->partition_sets().insert(*mesh_set);
+
+    // (global id, local handle) of the vertices shared with each neighboring rank
+    map<int, vector<pair<long, EntityHandle>>> nbr_verts;
+
+    for (int lid = 0; lid < (int)master.size(); lid++)
+    {
+        MeshBlock* b = master.block<MeshBlock>(lid);
+        const Bounds& bds = b->bounds;
+        int nx = bds.max[0] - bds.min[0] + 1;
+        int ny = bds.max[1] - bds.min[1] + 1;
+        diy::RegularDecomposer<Bounds>::DivisionsVector coords, nbr_coords(3);
+        decomp.gid_to_coords(b->gid, coords);
+
+        for (int k = bds.min[2]; k <= bds.max[2]; k++)
+        {
+            for (int j = bds.min[1]; j <= bds.max[1]; j++)
+            {
+                // only the end points of rows in the interior of the block can be on a face
+                bool row_on_face = j == bds.min[1] || j == bds.max[1] || k == bds.min[2] || k == bds.max[2];
+                for (int i = bds.min[0]; i <= bds.max[0];
+                        i += (row_on_face || i == bds.max[0]) ? 1 : bds.max[0] - bds.min[0])
+                {
+                    // range of block coordinates containing the vertex in each dim
+                    int p[3] = {i, j, k};
+                    int lo[3], hi[3];
+                    bool on_face = false;
+                    for (int d = 0; d < 3; d++)
+                    {
+                        lo[d] = hi[d] = coords[d];
+                        if (p[d] == bds.min[d] && coords[d] > 0)
+                        {
+                            lo[d]--;
+                            on_face = true;
+                        }
+                        if (p[d] == bds.max[d] && coords[d] < decomp.divisions[d] - 1)
+                        {
+                            hi[d]++;
+                            on_face = true;
+                        }
+                    }
+                    if (!on_face || vert_owner(master, lid, i, j, k) != lid)
+                        continue;
+
+                    long gid = (long)1 + (long)i + (long)j * (mesh_size[0]) +
+                        (long)k * (mesh_size[0]) * (mesh_size[1]);
+                    EntityHandle handle = b->vhandles[(i - bds.min[0]) + (j - bds.min[1]) * nx + (k - bds.min[2]) * nx * ny];
+
+                    // ranks of the blocks containing the vertex, each remote rank once
+                    int nbr_ranks[8];
+                    int num_nbr_ranks = 0;
+                    for (nbr_coords[2] = lo[2]; nbr_coords[2] <= hi[2]; nbr_coords[2]++)
+                        for (nbr_coords[1] = lo[1]; nbr_coords[1] <= hi[1]; nbr_coords[1]++)
+                            for (nbr_coords[0] = lo[0]; nbr_coords[0] <= hi[0]; nbr_coords[0]++)
+                            {
+                                int nbr_rank = assign.rank(decomp.coords_to_gid(nbr_coords));
+                                if (nbr_rank != rank &&
+                                        find(nbr_ranks, nbr_ranks + num_nbr_ranks, nbr_rank) == nbr_ranks + num_nbr_ranks)
+                                {
+                                    nbr_ranks[num_nbr_ranks++] = nbr_rank;
+                                    nbr_verts[nbr_rank].push_back(make_pair(gid, handle));
+                                }
+                            }
+                }
+            }
+        }
+    }
+
+    // exchange the handles of the shared vertices with each neighboring rank
+    // both sides list the vertices they share in order of global id, so handles are matched by position
+    map<int, vector<EntityHandle>> send_handles, recv_handles;
+    vector<MPI_Request> reqs;
+    for (auto& nv : nbr_verts)
+    {
+        sort(nv.second.begin(), nv.second.end());
+        vector<EntityHandle>& sh = send_handles[nv.first];
+        vector<EntityHandle>& rh = recv_handles[nv.first];
+        for (auto& v : nv.second)
+            sh.push_back(v.second);
+        rh.resize(sh.size());
+        reqs.resize(reqs.size() + 2);
+        MPI_Irecv(&rh[0], rh.size() * sizeof(EntityHandle), MPI_BYTE, nv.first, 0, mbpc->comm(), &reqs[reqs.size() - 2]);
+        MPI_Isend(&sh[0], sh.size() * sizeof(EntityHandle), MPI_BYTE, nv.first, 0, mbpc->comm(), &reqs[reqs.size() - 1]);
+    }
+    if (reqs.size())
+        MPI_Waitall(reqs.size(), &reqs[0], MPI_STATUSES_IGNORE);
+
+    // tuples of (remote rank, local handle, remote handle), sorted by local handle, for tag_shared_verts with no
+    // extra ints per tuple, as in ParallelMergeMesh
+    Range proc_verts;
+    size_t num_tuples = 0;
+    for (auto& nv : nbr_verts)
+    {
+        for (auto& v : nv.second)
+            proc_verts.insert(v.second);
+        num_tuples += nv.second.size();
+    }
+
+    TupleList shared_verts;
+    shared_verts.initialize(1, 0, 2, 0, num_tuples);
+    shared_verts.enableWriteAccess();
+    for (auto& nv : nbr_verts)
+    {
+        vector<EntityHandle>& rh = recv_handles[nv.first];
+        for (size_t v = 0; v < nv.second.size(); v++)
+        {
+            unsigned int n = shared_verts.get_n();
+            shared_verts.vi_wr[n]           = nv.first;
+            shared_verts.vul_wr[2 * n]      = nv.second[v].second;
+            shared_verts.vul_wr[2 * n + 1]  = rh[v];
+            shared_verts.inc_n();
+        }
+    }
+    // the sort is stable, so the remote ranks of each vertex stay in increasing order
+    TupleList::buffer sort_buffer;
+    sort_buffer.buffer_init(num_tuples);
+    shared_verts.sort(1, &sort_buffer);
+    sort_buffer.reset();
+
+    // set sharing procs, handles, and pstatus of the shared vertices
+    map<vector<int>, vector<EntityHandle>> proc_nvecs;
+    rval = mbpc->tag_shared_verts(shared_verts, proc_nvecs, proc_verts, 0); ERR;
+
+    // the shared faces and edges are the skin faces of the cells touching shared vertices whose vertices are all
+    // shared, and their edges, which resolve_shared_ents creates from the skin of the whole local mesh
+    Range skin_ents[4];
+    skin_ents[0] = proc_verts;
+    rval = mbint->get_adjacencies(proc_verts, 3, false, skin_ents[3], Interface::UNION); ERR;
+    Range layer_skin;
+    Skinner skinner(mbint);
+    rval = skinner.find_skin(0, skin_ents[3], false, layer_skin, NULL, true, true, true); ERR;
+    Range inner_faces;
+    for (Range::iterator it = layer_skin.begin(); it != layer_skin.end(); it++)
+    {
+        const EntityHandle* conn;
+        int num_conn;
+        vector<EntityHandle> storage;
+        rval = mbint->get_connectivity(*it, conn, num_conn, false, &storage); ERR;
+        bool shared = true;
+        for (int i = 0; i < num_conn && shared; i++)
+            shared = proc_verts.find(conn[i]) != proc_verts.end();
+        if (shared)
+            skin_ents[2].insert(*it);
+        else
+            inner_faces.insert(*it);
+    }
+    // the faces of the layer away from the interface are not part of the skin of the local mesh
+    rval = mbint->delete_entities(inner_faces); ERR;
+    rval = mbint->get_adjacencies(skin_ents[2], 1, true, skin_ents[1], Interface::UNION); ERR;
+
+    // group the faces and edges with the vertices they share, create interface sets, and set up communication
+    // buffers
+    rval = mbpc->get_proc_nvecs(3, 2, skin_ents, proc_nvecs); ERR;
+    rval = mbpc->create_interface_sets(proc_nvecs); ERR;
+    set<unsigned int> procs;
+    rval = mbpc->get_interface_procs(procs, true); ERR;
+
+    // remote handles of the shared faces and edges, as resolve_shared_ents does
+    rval = mbpc->exchange_ghost_cells(-1, -1, 0, 0, true, true); ERR;
+}
+
+// resolve shared entities of blocks with ghost layers directly from the decomposition, bypassing
+// resolve_shared_ents and exchange_ghost_cells
+// an entity is on every rank whose ghosted block bounds contain it, so the entities on both ranks of a pair are those
+// in the intersection of their bounds, listed by both ranks in the same i-j-k order; the only communication is one
+// exchange of their handles with each neighboring rank
+// each vertex and cell on more than one rank gets sharing procs (owner first), remote handles, and pstatus as after
+// ghost exchange: cells are owned by the rank whose core contains them, vertices by the lowest rank whose core
+// contains them; entities outside the local core are ghosts, and vertices in the cores of several ranks are interface
+// vertices, grouped into interface sets
+// the sharing procs of an entity are its owner and the other ranks holding a copy of it, ie, whose ghosted bounds
+// contain it, as exchange_ghost_cells lists the ranks it sends each entity to
+// supports one block per rank, and aborts the run otherwise
+void resolve_ghosts_from_decomposition(int cells_per_space,    // number of cells per grid space
+        Interface *mbint,                               // moab interface instance
+        EntityHandle *mesh_set,                         // moab mesh set
+        ParallelComm *mbpc,                             // moab parallel communicator
+        diy::RegularDecomposer<Bounds>& decomp,         // diy decomposition, with ghost layers
+        diy::RoundRobinAssigner& assign,                // diy assignment, one block per rank
+        diy::Master& master)                            // diy master with the generated local block
+{
+    ErrorCode rval;
+    int rank = mbpc->rank();
+
+    mbpc->partition_sets().insert(*mesh_set);
+    if (master.size() != 1)
+    {
+        fmt::print(stderr, "resolve_ghosts_from_decomposition: rank {} has {} blocks, but ghost layers need one block "
+                "per rank\n", rank, master.size());
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MeshBlock* b = master.block<MeshBlock>(0);
+    const Bounds& bds = b->bounds;
+    int nx = bds.max[0] - bds.min[0] + 1;
+    int ny = bds.max[1] - bds.min[1] + 1;
+
+    auto contains = [](const Bounds& box, int i, int j, int k)
+    {
+        return i >= box.min[0] && i <= box.max[0] && j >= box.min[1] && j <= box.max[1] &&
+            k >= box.min[2] && k <= box.max[2];
+    };
+
+    // local handles of the entities in the intersection of the bounds with the bounds of each neighboring rank,
+    // vertices first, then cells
+    map<int, vector<EntityHandle>> send_handles, recv_handles;
+    map<int, Bounds> nbr_cores;
+    for (int gid = 0; gid < assign.nblocks(); gid++)
+    {
+        if (gid == b->gid)
+            continue;
+        Bounds nbds(3), isect(3);
+        decomp.fill_bounds(nbds, gid, true);
+        bool empty = false;
+        for (int d = 0; d < 3; d++)
+        {
+            isect.min[d] = max(bds.min[d], nbds.min[d]);
+            isect.max[d] = min(bds.max[d], nbds.max[d]);
+            empty |= isect.min[d] > isect.max[d];
+        }
+        if (empty)
+            continue;
+
+        int nbr = assign.rank(gid);
+        Bounds& ncore = nbr_cores.emplace(nbr, Bounds(3)).first->second;
+        decomp.fill_bounds(ncore, gid);
+
+        vector<EntityHandle>& sh = send_handles[nbr];
+        for (int k = isect.min[2]; k <= isect.max[2]; k++)
+            for (int j = isect.min[1]; j <= isect.max[1]; j++)
+                for (int i = isect.min[0]; i <= isect.max[0]; i++)
+                    sh.push_back(b->vhandles[(i - bds.min[0]) + (j - bds.min[1]) * nx + (k - bds.min[2]) * nx * ny]);
+        for (int k = isect.min[2]; k < isect.max[2]; k++)
+            for (int j = isect.min[1]; j < isect.max[1]; j++)
+                for (int i = isect.min[0]; i < isect.max[0]; i++)
+                    for (int t = 0; t < cells_per_space; t++)
+                        sh.push_back(cell_handle(b, cells_per_space, i, j, k, t));
+    }
+
+    // exchange the handles with each neighboring rank; both sides list them in the same order
+    vector<MPI_Request> reqs;
+    for (auto& sh : send_handles)
+    {
+        vector<EntityHandle>& rh = recv_handles[sh.first];
+        rh.resize(sh.second.size());
+        reqs.resize(reqs.size() + 2);
+        MPI_Irecv(&rh[0], rh.size() * sizeof(EntityHandle), MPI_BYTE, sh.first, 0, mbpc->comm(), &reqs[reqs.size() - 2]);
+        MPI_Isend(&sh.second[0], sh.second.size() * sizeof(EntityHandle), MPI_BYTE, sh.first, 0, mbpc->comm(),
+                &reqs[reqs.size() - 1]);
+    }
+    if (reqs.size())
+        MPI_Waitall(reqs.size(), &reqs[0], MPI_STATUSES_IGNORE);
+
+    // (rank, handle) of the copies of each entity on other ranks
+    map<EntityHandle, vector<pair<int, EntityHandle>>> remotes;
+    for (auto& sh : send_handles)
+    {
+        vector<EntityHandle>& rh = recv_handles[sh.first];
+        for (size_t n = 0; n < rh.size(); n++)
+            remotes[sh.second[n]].push_back(make_pair(sh.first, rh[n]));
+    }
+
+    // owner and pstatus of each entity, from its position in the cores of the ranks
+    map<vector<int>, vector<EntityHandle>> proc_nvecs;      // interface vertices by their sharing procs
+    long no_owner = 0;                                      // entities whose owner holds no copy of them
+    auto set_sharing = [&](EntityHandle h, int owner, bool ghost, const vector<int>& iface_procs)
+    {
+        // the ranks holding a copy, this one included, in increasing order; the owner goes first
+        vector<pair<int, EntityHandle>> holders = remotes[h];
+        holders.push_back(make_pair(rank, h));
+        sort(holders.begin(), holders.end());
+        auto own = find_if(holders.begin(), holders.end(),
+                [owner](const pair<int, EntityHandle>& r) { return r.first == owner; });
+        if (own == holders.end())
+        {
+            no_owner++;
+            return;
+        }
+        rotate(holders.begin(), own, own + 1);
+
+        vector<int>             ps;
+        vector<EntityHandle>    hs;
+        for (auto& r : holders)
+        {
+            ps.push_back(r.first);
+            hs.push_back(r.second);
+        }
+
+        unsigned char pstat = PSTATUS_SHARED;
+        if (ps.size() > 2)
+            pstat |= PSTATUS_MULTISHARED;
+        if (owner != rank)
+            pstat |= PSTATUS_NOT_OWNED;
+        if (ghost)
+            pstat |= PSTATUS_GHOST;
+        else if (iface_procs.size() > 1)
+        {
+            pstat |= PSTATUS_INTERFACE;
+            proc_nvecs[iface_procs].push_back(h);
+        }
+        rval = mbpc->set_sharing_data(h, pstat, 0, ps.size(), &ps[0], &hs[0]); ERR;
+    };
+
+    // vertices, visited by position
+    int v = 0;
+    for (int k = bds.min[2]; k <= bds.max[2]; k++)
+        for (int j = bds.min[1]; j <= bds.max[1]; j++)
+            for (int i = bds.min[0]; i <= bds.max[0]; i++, v++)
+            {
+                EntityHandle h = b->vhandles[v];
+                auto rem = remotes.find(h);
+                if (rem == remotes.end())
+                    continue;
+                // the vertex is owned by the lowest rank whose core contains it
+                vector<int> iface_procs;
+                if (contains(b->core, i, j, k))
+                    iface_procs.push_back(rank);
+                for (auto& r : rem->second)
+                    if (contains(nbr_cores.at(r.first), i, j, k))
+                        iface_procs.push_back(r.first);
+                sort(iface_procs.begin(), iface_procs.end());
+                set_sharing(h, iface_procs[0], !contains(b->core, i, j, k), iface_procs);
+            }
+
+    // cells, visited by grid space to recover their positions
+    for (int k = bds.min[2]; k < bds.max[2]; k++)
+        for (int j = bds.min[1]; j < bds.max[1]; j++)
+            for (int i = bds.min[0]; i < bds.max[0]; i++)
+                for (int t = 0; t < cells_per_space; t++)
+                {
+                    EntityHandle h = cell_handle(b, cells_per_space, i, j, k, t);
+                    auto rem = remotes.find(h);
+                    if (rem == remotes.end())
+                        continue;
+                    // the cell is owned by the rank whose core contains its grid space
+                    bool ghost = !(contains(b->core, i, j, k) && contains(b->core, i + 1, j + 1, k + 1));
+                    int owner = ghost ? -1 : rank;
+                    if (ghost)
+                        for (auto& r : rem->second)
+                            if (contains(nbr_cores.at(r.first), i, j, k) &&
+                                    contains(nbr_cores.at(r.first), i + 1, j + 1, k + 1))
+                                owner = r.first;
+                    set_sharing(h, owner, ghost, vector<int>());
+                }
+
+    // every entity is in the core of a rank holding it, unless the decomposition and the generated blocks disagree
+    if (no_owner)
+    {
+        fmt::print(stderr, "resolve_ghosts_from_decomposition: rank {} has {} shared entities whose owner holds no "
+                "copy\n", rank, no_owner);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // create interface sets and set up communication buffers with all neighboring ranks
+    rval = mbpc->create_interface_sets(proc_nvecs); ERR;
+    set<unsigned int> procs;
+    rval = mbpc->get_interface_procs(procs, true); ERR;
+    for (auto& sh : send_handles)
+        mbpc->get_buffers(sh.first);
+}
+
+// validates resolve_from_decomposition against resolve_shared_ents
+// regenerates the mesh in a second moab instance, resolves it with resolve_shared_ents, and compares the sharing
+// procs, remote handles, and pstatus of every vertex; generation is deterministic, so the vertex handles are the same
+// in both instances
+// faces and edges are created during resolve in a different order, so the shared ones are matched by their vertices
+// and compared by sharing procs and pstatus
+void validate_resolve(int *mesh_size,                   // mesh size (i,j,k) number of vertices in each dim
+        int mesh_type,                                  // mesh type (0 = hex, 1 = tet, 2 = structured hex)
+        Interface *mbint,                               // moab interface instance resolved from the decomposition
+        ParallelComm *mbpc,                             // moab parallel communicator
+        diy::RegularDecomposer<Bounds>& decomp,         // diy decomposition
+        diy::RoundRobinAssigner& assign,                // diy assignment
+        const TaskParams& params)                       // task parameters the mesh was generated with
+{
+    ErrorCode rval;
+    Interface*      ref_mbi = new Core();
+    ParallelComm*   ref_pc  = new ParallelComm(ref_mbi, mbpc->comm());
+    EntityHandle    ref_root;
+    rval = ref_mbi->create_meshset(MESHSET_SET, ref_root); ERR;
+
+    create_mesh(mesh_type, mesh_size, ref_mbi, &ref_root, ref_pc, decomp, assign, params);
+    resolve_and_exchange(ref_mbi, &ref_root, ref_pc);
+
+    Range verts;
+    rval = ref_mbi->get_entities_by_dimension(ref_root, 0, verts); ERR;
+
+    const unsigned char mask = PSTATUS_NOT_OWNED | PSTATUS_SHARED | PSTATUS_MULTISHARED | PSTATUS_INTERFACE;
+    long mismatches = 0;
+    for (Range::iterator it = verts.begin(); it != verts.end(); it++)
+    {
+        int ps[MAX_SHARING_PROCS], ref_ps[MAX_SHARING_PROCS];
+        EntityHandle hs[MAX_SHARING_PROCS], ref_hs[MAX_SHARING_PROCS];
+        int num_ps = 0, ref_num_ps = 0;
+        unsigned char pstat = 0, ref_pstat = 0;
+        rval = ref_pc->get_sharing_data(*it, ref_ps, ref_hs, ref_pstat, ref_num_ps); ERR;
+        rval = mbpc->get_sharing_data(*it, ps, hs, pstat, num_ps); ERR;
+
+        vector<pair<int, EntityHandle>> sharing, ref_sharing;
+        for (int i = 0; i < num_ps; i++)
+            sharing.push_back(make_pair(ps[i], hs[i]));
+        for (int i = 0; i < ref_num_ps; i++)
+            ref_sharing.push_back(make_pair(ref_ps[i], ref_hs[i]));
+        sort(sharing.begin(), sharing.end());
+        sort(ref_sharing.begin(), ref_sharing.end());
+
+        if (sharing != ref_sharing || (pstat & mask) != (ref_pstat & mask))
+        {
+            if (mismatches == 0)
+                fmt::print(stderr, "validate_resolve: rank {} first mismatch at vertex {}: "
+                        "num_ps {} pstatus {:#x} (resolve_shared_ents: num_ps {} pstatus {:#x})\n",
+                        mbpc->rank(), *it, num_ps, pstat, ref_num_ps, ref_pstat);
+            mismatches++;
+        }
+    }
+
+    long ent_mismatches = 0;
+    for (int dim = 1; dim <= 2; dim++)
+    {
+        Range ents, ref_ents;
+        rval = mbpc->get_shared_entities(-1, ents, dim); ERR;
+        rval = ref_pc->get_shared_entities(-1, ref_ents, dim); ERR;
+        if (ents.size() != ref_ents.size())
+        {
+            fmt::print(stderr, "validate_resolve: rank {} has {} shared entities of dimension {} "
+                    "(resolve_shared_ents: {})\n", mbpc->rank(), ents.size(), dim, ref_ents.size());
+            ent_mismatches++;
+        }
+
+        for (Range::iterator it = ref_ents.begin(); it != ref_ents.end(); it++)
+        {
+            const EntityHandle* conn;
+            int num_conn;
+            vector<EntityHandle> storage, match;
+            rval = ref_mbi->get_connectivity(*it, conn, num_conn, false, &storage); ERR;
+            rval = mbint->get_adjacencies(conn, num_conn, dim, false, match); ERR;
+
+            int ps[MAX_SHARING_PROCS], ref_ps[MAX_SHARING_PROCS];
+            EntityHandle hs[MAX_SHARING_PROCS], ref_hs[MAX_SHARING_PROCS];
+            int num_ps = 0, ref_num_ps = 0;
+            unsigned char pstat = 0, ref_pstat = 0;
+            rval = ref_pc->get_sharing_data(*it, ref_ps, ref_hs, ref_pstat, ref_num_ps); ERR;
+            if (match.size() == 1)
+            {
+                rval = mbpc->get_sharing_data(match[0], ps, hs, pstat, num_ps); ERR;
+            }
+            sort(ps, ps + num_ps);
+            sort(ref_ps, ref_ps + ref_num_ps);
+
+            if (match.size() != 1 || num_ps != ref_num_ps || !equal(ps, ps + num_ps, ref_ps) ||
+                    (pstat & mask) != (ref_pstat & mask))
+            {
+                if (ent_mismatches == 0)
+                    fmt::print(stderr, "validate_resolve: rank {} first mismatch at entity of dimension {}: "
+                            "{} matches num_ps {} pstatus {:#x} (resolve_shared_ents: num_ps {} pstatus {:#x})\n",
+                            mbpc->rank(), dim, match.size(), num_ps, pstat, ref_num_ps, ref_pstat);
+                ent_mismatches++;
+            }
+        }
+    }
+
+    long tot_mismatches, tot_ent_mismatches;
+    MPI_Reduce(&mismatches, &tot_mismatches, 1, MPI_LONG, MPI_SUM, 0, mbpc->comm());
+    MPI_Reduce(&ent_mismatches, &tot_ent_mismatches, 1, MPI_LONG, MPI_SUM, 0, mbpc->comm());
+    if (mbpc->rank() == 0)
+    {
+        const char* type = mesh_type == 0 ? "hex" : (mesh_type == 1 ? "tet" : "structured hex");
+        fmt::print(stderr, "validate_resolve: {} {} mesh vertices with sharing different from resolve_shared_ents\n",
+                tot_mismatches, type);
+        fmt::print(stderr, "validate_resolve: {} {} mesh edge and face mismatches with resolve_shared_ents\n",
+                tot_ent_mismatches, type);
+    }
+
+    delete ref_pc;
+    delete ref_mbi;
+}
+
+// returns the kernel evaluating PhysField on a batch of points
+FieldKernel PhysFieldKernel(double factor)
+{
+    return [factor](const double* x, const double* y, const double* z, size_t n, double* f)
+    {
+        for (size_t i = 0; i < n; i++)
+            f[i] = PhysField(x[i], y[i], z[i], factor);
+    };
+}
+
+// gets views of the coordinate arrays of a range of vertices
+ErrorCode VertexCoords::init(Interface *mbi,
+        const Range& verts)
+{
+    ErrorCode rval;
+    start.clear();
+    count.clear();
+    x.clear();
+    y.clear();
+    z.clear();
+
+    run.clear();
+
+    Range::iterator it = verts.begin();
+    while (it != verts.end())
+    {
+        double *vx, *vy, *vz;
+        int n;
+        rval = mbi->coords_iterate(it, verts.end(), vx, vy, vz, n);
+        if (rval != MB_SUCCESS)
+            return rval;
+        start.push_back(*it);
+        count.push_back(n);
+        x.push_back(vx);
+        y.push_back(vy);
+        z.push_back(vz);
+        it += n;
+    }
+
+    // run of each handle between the first and last vertex, unless the handles are too sparse for a table
+    if (!verts.empty() && verts.back() - verts.front() < 2 * verts.size())
+    {
+        run.assign(verts.back() - verts.front() + 1, -1);
+        for (size_t s = 0; s < start.size(); s++)
+            fill(run.begin() + (start[s] - verts.front()), run.begin() + (start[s] - verts.front()) + count[s], s);
+    }
+    return MB_SUCCESS;
+}
+
+// finds the coordinates of vertex h
+// returns the index of the run containing h, or -1 if h is not in the vertices
+int VertexCoords::find(EntityHandle h,
+        double& vx,
+        double& vy,
+        double& vz) const
+{
+    int s;
+    if (!run.empty())
+    {
+        if (h < start[0] || h - start[0] >= run.size() || (s = run[h - start[0]]) < 0)
+            return -1;
+    }
+    else
+    {
+        s = std::upper_bound(start.begin(), start.end(), h) - start.begin() - 1;
+        if (s < 0 || h - start[s] >= (EntityHandle)count[s])
+            return -1;
+    }
+    vx = x[s][h - start[s]];
+    vy = y[s][h - start[s]];
+    vz = z[s][h - start[s]];
+    return s;
+}
+
+// computes the centroids (average of the vertices, as moab get_coords does for cells) of a batch of cells, in SoA form
+void cell_centroids(const VertexCoords& vcoords,        // vertex coordinates
+        const EntityHandle *conn,                       // connectivity of the cells
+        int nv,                                         // number of vertices per cell
+        size_t n,                                       // number of cells
+        double *cx,                                     // (output) centroid x coordinates
+        double *cy,                                     // (output) centroid y coordinates
+        double *cz,                                     // (output) centroid z coordinates
+        int threads)                                    // number of threads
+{
+    parallel_for(n, threads, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; c++)
+        {
+            double sx = 0.0, sy = 0.0, sz = 0.0;
+            for (int v = 0; v < nv; v++)
+            {
+                double vx = 0.0, vy = 0.0, vz = 0.0;
+                vcoords.find(conn[c * nv + v], vx, vy, vz);
+                sx += vx;
+                sy += vy;
+                sz += vz;
+            }
+            cx[c] = sx / nv;
+            cy[c] = sy / nv;
+            cz[c] = sz / nv;
+        }
+    });
+}
+
+// calls f(x, y, z, field, n) on each run of the vertices (dim = 0) or cells (dim > 0) of a mesh set whose field tag
+// storage is contiguous, where x, y, z are the coordinates of the n vertices or cell centroids of the run
+static void field_runs(Interface *mbi,
+        EntityHandle eh,
+        Tag fieldTag,
+        int dim,
+        int threads,
+        const function<void(const double*, const double*, const double*, double*, size_t)>& f)
+{
+    Range ents;
+    ErrorCode rval;
+
+    if (dim == 0)
+    {
+        rval = mbi->get_entities_by_type(eh, MBVERTEX, ents); ERR;
+    }
+    else
+    {
+        rval = mbi->get_entities_by_dimension(eh, dim, ents); ERR;
+    }
+
+    // coordinates of the vertices of the cells
+    VertexCoords vcoords;
+    if (dim > 0)
+    {
+        Range verts;
+        rval = mbi->get_connectivity(ents, verts); ERR;
+        rval = vcoords.init(mbi, verts); ERR;
+    }
+    vector<double> cx, cy, cz;                  // cell centroids
+    vector<EntityHandle> conn_copy;             // connectivity of structured cells
+
+    Range::iterator it = ents.begin();
+    while (it != ents.end())
+    {
+        // the largest run of entities with contiguous tag and coordinate (or connectivity) storage
+        int count;
+        double *fld;
+        const double *x, *y, *z;
+        rval = mbi->tag_iterate(fieldTag, it, ents.end(), count, (void *&)fld); ERR;
+        if (rval != MB_SUCCESS)
+            break;
+
+        if (dim == 0)
+        {
+            double *vx, *vy, *vz;
+            int vcount;
+            rval = mbi->coords_iterate(it, ents.end(), vx, vy, vz, vcount); ERR;
+            if (rval != MB_SUCCESS)
+                break;
+            count = std::min(count, vcount);
+            x = vx;
+            y = vy;
+            z = vz;
+        }
+        else
+        {
+            // structured element sequences have no connectivity array to iterate; get a copy instead
+            EntityHandle *conn;
+            int nv, ccount;
+            if (mbi->connect_iterate(it, ents.end(), conn, nv, ccount) == MB_SUCCESS)
+                count = std::min(count, ccount);
+            else
+            {
+                vector<EntityHandle> handles(count);
+                for (int i = 0; i < count; i++)
+                    handles[i] = *it + i;
+                rval = mbi->get_connectivity(&handles[0], count, conn_copy); ERR;
+                if (rval != MB_SUCCESS)
+                    break;
+                conn = &conn_copy[0];
+                nv   = conn_copy.size() / count;
+            }
+            cx.resize(count);
+            cy.resize(count);
+            cz.resize(count);
+            cell_centroids(vcoords, conn, nv, count, &cx[0], &cy[0], &cz[0], threads);
+            x = &cx[0];
+            y = &cy[0];
+            z = &cz[0];
+        }
+
+        f(x, y, z, fld, count);
+
+        it += count;
+    }
+}
+
+// evaluates an analytic field at the vertices (dim = 0) or cell centroids (dim > 0) of a mesh set
+// and writes it directly into the dense storage of a double tag, one contiguous sequence at a time
+void PutField(Interface *mbi,
         EntityHandle eh,
         const char *tagname,
-        double factor)
+        int dim,
+        const FieldKernel& kernel,
+        int threads)
 {
-    Range elems;
     ErrorCode rval;
     const double defVal = 0.;
     Tag fieldTag;
-
-    rval = mbi->get_entities_by_dimension(eh, 3, elems); ERR;
     rval = mbi->tag_get_handle(tagname, 1, MB_TYPE_DOUBLE, fieldTag,
             MB_TAG_DENSE|MB_TAG_CREAT, &defVal); ERR;
 
-    for(int i = 0; i< (int)elems.size(); i++)
+    field_runs(mbi, eh, fieldTag, dim, threads, [&](const double* x, const double* y, const double* z, double* f, size_t n)
+    {
+        parallel_for(n, threads, [&](size_t begin, size_t end)
+        {
+            kernel(x + begin, y + begin, z + begin, end - begin, f + begin);
+        });
+    });
+}
+
+// combines the errors of two sets of entities
+void FieldError::combine(const FieldError& other)
+{
+    n       += other.n;
+    l1      += other.l1;
+    l2      += other.l2;
+    linf    = max(linf, other.linf);
+}
+
+// reduction op over FieldError records
+static void combine_field_errors(void* in_, void* inout_, int* len, MPI_Datatype*)
+{
+    FieldError* in      = static_cast<FieldError*>(in_);
+    FieldError* inout   = static_cast<FieldError*>(inout_);
+    for (int i = 0; i < *len; i++)
+        inout[i].combine(in[i]);
+}
+
+// errors of a field at the vertices (dim = 0) or cell centroids (dim > 0) of a mesh set on this rank
+static FieldError local_field_error(Interface *mbi,
+        EntityHandle eh,
+        const char *tagname,
+        int dim,
+        const FieldKernel& kernel,
+        int threads)
+{
+    ErrorCode rval;
+    Tag fieldTag;
+    FieldError loc;
+
+    rval = mbi->tag_get_handle(tagname, 1, MB_TYPE_DOUBLE, fieldTag);
+    if (rval != MB_SUCCESS)
+    {
+        fmt::print(stderr, "CheckField: no field {} to check\n", tagname);
+        loc.linf = std::numeric_limits<double>::infinity();
+    }
+    else
     {
-        EntityHandle elem = elems[i];
-        double pos[3];
-        rval = mbi->get_coords(&elem, 1, pos); ERR;
-        double field_value =  PhysField(pos[0], pos[1], pos[2], factor);
-        rval = mbi->tag_set_data(fieldTag, &elem, 1, &field_value); ERR;
+        mutex mtx;
+        field_runs(mbi, eh, fieldTag, dim, threads, [&](const double* x, const double* y, const double* z, double* f, size_t n)
+        {
+            parallel_for(n, threads, [&](size_t begin, size_t end)
+            {
+                // reference values in chunks small enough to stay in cache
+                const size_t chunk = 1024;
+                double ref[chunk];
+                FieldError err;
+                for (size_t c = begin; c < end; c += chunk)
+                {
+                    size_t m = std::min(chunk, end - c);
+                    kernel(x + c, y + c, z + c, m, ref);
+                    double l1 = 0.0, l2 = 0.0, linf = 0.0;
+                    for (size_t i = 0; i < m; i++)
+                    {
+                        double e = fabs(f[c + i] - ref[i]);
+                        l1      += e;
+                        l2      += e * e;
+                        linf    = e > linf ? e : linf;
+                    }
+                    err.l1      += l1;
+                    err.l2      += l2;
+                    err.linf    = max(err.linf, linf);
+                }
+                err.n = end - begin;
 
-        // debug
-        //     fprintf(stderr, "setting element %d: f(%.3lf, %.3lf, %.3lf) = %.3lf\n",
-        // 	    i, x, y, z, fieldValue);
+                lock_guard<mutex> lock(mtx);
+                loc.combine(err);
+            });
+        });
     }
+
+    return loc;
 }
 
-// gets the element field
-void GetElementField(Interface *mbi,
+// combines the errors of a field over all ranks of comm
+// the datatype and op are created on first use and kept for the rest of the run
+static FieldError reduce_field_error(const FieldError& loc,
+        MPI_Comm comm)
+{
+    static MPI_Datatype err_type = []()
+    {
+        MPI_Datatype type;
+        MPI_Type_contiguous(sizeof(FieldError), MPI_BYTE, &type);
+        MPI_Type_commit(&type);
+        return type;
+    }();
+    static MPI_Op err_op = []()
+    {
+        MPI_Op op;
+        MPI_Op_create(&combine_field_errors, 1, &op);
+        return op;
+    }();
+
+    FieldError glo;
+    MPI_Allreduce(&loc, &glo, 1, err_type, err_op, comm);
+    return glo;
+}
+
+// verifies a field at the vertices (dim = 0) or cell centroids (dim > 0) of a mesh set against an analytic field
+// reads the tag storage in place, recomputes the reference in bulk, and returns the errors over all ranks of comm
+// (sums of |error| and error^2 and max |error|; see FieldError for the norms)
+// entities shared by several ranks are checked on each of them
+FieldError CheckField(Interface *mbi,
         EntityHandle eh,
         const char *tagname,
-        double factor,
+        int dim,
+        const FieldKernel& kernel,
         MPI_Comm comm,
-        bool debug)
+        int threads)
 {
-    Range elems;
-    double *field_values;
+    return reduce_field_error(local_field_error(mbi, eh, tagname, dim, kernel, threads), comm);
+}
 
-    mbi->get_entities_by_dimension(eh, 3, elems);
+// prints the errors of a field checked by CheckField on rank 0 of comm, and returns whether the field matches
+// within the tolerance
+static bool report_field_error(const char *tagname,
+        const FieldError& err,
+        MPI_Comm comm,
+        double tol)
+{
+    bool ok = err.linf <= tol;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0)
+        fmt::print(stderr, "{}: {} values, L1 {:.3e} L2 {:.3e} Linf {:.3e} {}\n",
+                tagname, err.n, err.norm_l1(), err.norm_l2(), err.linf, ok ? "ok" : "MISMATCH");
+    return ok;
+}
 
-    Tag field_tag;
-    int count;
-    mbi->tag_get_handle(tagname, 1, MB_TYPE_DOUBLE, field_tag);
-    mbi->tag_iterate(field_tag, elems.begin(), elems.end(), count,
-            (void *&)field_values);
-    assert(count == (int)elems.size());
+// add a value to each element in the field
+void PutElementField(Interface *mbi,
+        EntityHandle eh,
+        const char *tagname,
+        double factor,
+        int threads)
+{
+    PutField(mbi, eh, tagname, 3, PhysFieldKernel(factor), threads);
+}
 
-    for(int i = 0; i < (int)elems.size(); i++)
+// checks the element field against PhysField, with global error norms over comm
+// debug: also print the errors of this rank
+// tol: largest error of a matching field
+bool GetElementField(Interface *mbi,
+        EntityHandle eh,
+        const char *tagname,
+        double factor,
+        MPI_Comm comm,
+        int threads,
+        bool debug,
+        double tol)
+{
+    FieldError loc = local_field_error(mbi, eh, tagname, 3, PhysFieldKernel(factor), threads);
+    if (debug)
     {
-        EntityHandle elem = elems[i];
-        double pos[3];
-        mbi->get_coords(&elem, 1, pos);
-        double ref_value = PhysField(pos[0], pos[1], pos[2], factor);
-
-        // debug
-        if (debug)
-            fprintf(stderr, "element %d: f(%.3lf, %.3lf, %.3lf) = %.3lf "
-                    "ref_value = %.3lf\n",
-                    i, pos[0], pos[1], pos[2], field_values[i], ref_value);
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+        fmt::print(stderr, "rank {} {}: {} values, Linf {:.3e}\n", rank, tagname, loc.n, loc.linf);
     }
+    return report_field_error(tagname, reduce_field_error(loc, comm), comm, tol);
 }
 
 // add a value to each vertex in the field
 void PutVertexField(Interface *mbi,
         EntityHandle eh,
         const char *tagname,
-        double factor)
+        double factor,
+        int threads)
 {
-    Range verts;
+    PutField(mbi, eh, tagname, 0, PhysFieldKernel(factor), threads);
+}
 
-    mbi->get_entities_by_type(eh, MBVERTEX, verts);
+// checks the vertex field against PhysField, with global error norms over comm
+// debug: also print the errors of this rank
+// tol: largest error of a matching field
+bool GetVertexField(Interface *mbi,
+        EntityHandle eh,
+        const char *tagname,
+        double factor,
+        MPI_Comm comm,
+        int threads,
+        bool debug,
+        double tol)
+{
+    FieldError loc = local_field_error(mbi, eh, tagname, 0, PhysFieldKernel(factor), threads);
+    if (debug)
+    {
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+        fmt::print(stderr, "rank {} {}: {} values, Linf {:.3e}\n", rank, tagname, loc.n, loc.linf);
+    }
+    return report_field_error(tagname, reduce_field_error(loc, comm), comm, tol);
+}
 
-    const double defVal = 0.;
-    Tag fieldTag;
-    mbi->tag_get_handle(tagname, 1, MB_TYPE_DOUBLE, fieldTag,
-            MB_TAG_DENSE|MB_TAG_CREAT, &defVal);
+// per-rank mesh quantities combined across ranks in one reduction
+struct MeshStats
+{
+    long long   verts;                      // owned vertices (sum)
+    long long   shared_verts;               // owned vertices shared with other ranks (sum)
+    long long   cells;                      // owned cells (sum)
+    long long   min_cells, max_cells;       // owned cells per rank
+    double      sum_shared_frac;            // fraction of the local vertices shared with other ranks, per rank
+    double      min_shared_frac, max_shared_frac;
+    long long   sum_mem, min_mem, max_mem;  // bytes used by the mesh per rank, as estimated by moab
+
+    static void reduce(void* in_, void* inout_, int* len, MPI_Datatype*)
+    {
+        MeshStats* in       = static_cast<MeshStats*>(in_);
+        MeshStats* inout    = static_cast<MeshStats*>(inout_);
+        for (int i = 0; i < *len; i++)
+        {
+            MeshStats& a        = in[i];
+            MeshStats& b        = inout[i];
+            b.verts             += a.verts;
+            b.shared_verts      += a.shared_verts;
+            b.cells             += a.cells;
+            b.min_cells         = min(b.min_cells, a.min_cells);
+            b.max_cells         = max(b.max_cells, a.max_cells);
+            b.sum_shared_frac   += a.sum_shared_frac;
+            b.min_shared_frac   = min(b.min_shared_frac, a.min_shared_frac);
+            b.max_shared_frac   = max(b.max_shared_frac, a.max_shared_frac);
+            b.sum_mem           += a.sum_mem;
+            b.min_mem           = min(b.min_mem, a.min_mem);
+            b.max_mem           = max(b.max_mem, a.max_mem);
+        }
+    }
+};
 
-    int numVerts = verts.size();
+// prints mesh statistics: global entity counts and per-rank load balance
+// sharing status is read in bulk from the pstatus tag; each vertex and cell is counted once, by its owner, with exact
+// integer counts, and all quantities are combined in a single reduction
+void PrintMeshStats(Interface *mbint,        // moab interface
+        EntityHandle *mesh_set,  // moab mesh set
+        ParallelComm *mbpc)      // moab parallel communicator
+{
+    ErrorCode rval;
+    static int mesh_num = 0;                 // counts how many time this function is called
+    MeshStats loc;
 
-    for(int i = 0; i < numVerts; i++)
+    // vertices
+    Range verts;
+    rval = mbint->get_entities_by_dimension(*mesh_set, 0, verts); ERR;
+    vector<unsigned char> pstat(verts.size());
+    if (verts.size())
     {
-        EntityHandle vert = verts[i];
-        double pos[3];
-        mbi->get_coords(&vert, 1, pos);
-        double fieldValue =  PhysField(pos[0], pos[1], pos[2], factor);
-        mbi->tag_set_data(fieldTag, &vert, 1, &fieldValue);
+        rval = mbint->tag_get_data(mbpc->pstatus_tag(), verts, &pstat[0]); ERR;
+    }
+    long long loc_verts = 0, loc_shared = 0; // all local vertices (excluding ghosts) and those shared
+    loc.verts = loc.shared_verts = 0;
+    for (size_t i = 0; i < pstat.size(); i++)
+    {
+        if (pstat[i] & PSTATUS_GHOST)
+            continue;
+        bool shared = (pstat[i] & PSTATUS_SHARED) != 0;
+        loc_verts++;
+        loc_shared += shared;
+        if (!(pstat[i] & PSTATUS_NOT_OWNED))
+        {
+            loc.verts++;
+            loc.shared_verts += shared;
+        }
+    }
+
+    // cells
+    Range cells;
+    rval = mbint->get_entities_by_dimension(*mesh_set, 3, cells); ERR;
+    rval = mbpc->filter_pstatus(cells, PSTATUS_NOT_OWNED, PSTATUS_NOT); ERR;
+    loc.cells = loc.min_cells = loc.max_cells = cells.size();
+
+    loc.sum_shared_frac = loc.min_shared_frac = loc.max_shared_frac =
+        loc_verts ? (double)loc_shared / loc_verts : 0.0;
+
+    unsigned long long mem;
+    mbint->estimated_memory_use(0, 0, &mem);
+    loc.sum_mem = loc.min_mem = loc.max_mem = mem;
+
+    // one reduction of all quantities
+    MeshStats glo;
+    MPI_Datatype stats_type;
+    MPI_Op stats_op;
+    MPI_Type_contiguous(sizeof(MeshStats), MPI_BYTE, &stats_type);
+    MPI_Type_commit(&stats_type);
+    MPI_Op_create(&MeshStats::reduce, 1, &stats_op);
+    MPI_Reduce(&loc, &glo, 1, stats_type, stats_op, 0, mbpc->comm());
+    MPI_Op_free(&stats_op);
+    MPI_Type_free(&stats_type);
 
-        // debug
-        //     fprintf(stderr, "setting element %d: f(%.3lf, %.3lf, %.3lf) = %.3lf\n",
-        // 	    i, pos[0], pos[1], pos[2], fieldValue);
+    // report results
+    if (mbpc->rank() == 0)
+    {
+        int nprocs = mbpc->size();
+        double mean_cells = (double)glo.cells / nprocs;
+        fmt::print(stderr, "----------------- Mesh {} statistics -----------------\n", mesh_num);
+        fmt::print(stderr, "Total number of verts = {} of which {} are shared\n", glo.verts, glo.shared_verts);
+        fmt::print(stderr, "Total number of cells = {}\n", glo.cells);
+        fmt::print(stderr, "Cells per rank: min {} max {} mean {:.1f} imbalance (max / mean) {:.3f}\n",
+                glo.min_cells, glo.max_cells, mean_cells, mean_cells > 0 ? glo.max_cells / mean_cells : 0.0);
+        fmt::print(stderr, "Shared vertex fraction per rank: min {:.4f} max {:.4f} mean {:.4f}\n",
+                glo.min_shared_frac, glo.max_shared_frac, glo.sum_shared_frac / nprocs);
+        fmt::print(stderr, "Mesh memory: total {:.2f} MB per rank min {:.2f} max {:.2f} mean {:.2f} MB\n",
+                glo.sum_mem / 1048576.0, glo.min_mem / 1048576.0, glo.max_mem / 1048576.0,
+                glo.sum_mem / 1048576.0 / nprocs);
+        fmt::print(stderr, "------------------------------------------------------\n");
     }
+
+    mesh_num = (mesh_num + 1) % 2;
+}
+
+// records the version of the topology of a mesh on its mesh set, written to file with the mesh
+// the version changes only when the topology does, so that later time steps can carry only the fields
+void SetMeshVersion(Interface *mbi,                 // moab interface
+        EntityHandle eh,                            // mesh set
+        int version)                                // mesh version
+{
+    ErrorCode rval;
+    Tag versionTag;
+    rval = mbi->tag_get_handle("MESH_VERSION", 1, MB_TYPE_INTEGER, versionTag, MB_TAG_SPARSE|MB_TAG_CREAT); ERR;
+    rval = mbi->tag_set_data(versionTag, &eh, 1, &version); ERR;
 }
 
-// gets the vertex field
-void GetVertexField(Interface *mbi,
+// version of the topology of a mesh read from file, -1 if the file did not record one
+int GetMeshVersion(Interface *mbi)                  // moab interface
+{
+    Tag versionTag;
+    if (mbi->tag_get_handle("MESH_VERSION", 1, MB_TYPE_INTEGER, versionTag) != MB_SUCCESS)
+        return -1;
+    Range sets;
+    if (mbi->get_entities_by_type_and_tag(0, MBENTITYSET, &versionTag, NULL, 1, sets) != MB_SUCCESS || sets.empty())
+        return -1;
+    int version;
+    EntityHandle set = sets.front();
+    if (mbi->tag_get_data(versionTag, &set, 1, &version) != MB_SUCCESS)
+        return -1;
+    return version;
+}
+
+// fields transferred without the topology, and the dimension of the entities that carry them
+static const pair<const char*, int> delta_fields[] = { { "vertex_field", 0 }, { "element_field", 3 } };
+
+// vertices (dim = 0) or cells (dim > 0) of a mesh set sorted by global id, and their global ids
+// pc: if not null, only the entities owned by this rank
+static void sorted_by_gid(Interface *mbi,
+        ParallelComm *pc,
         EntityHandle eh,
-        const char *tagname,
-        double factor,
-        MPI_Comm comm,
-        bool debug)
+        int dim,
+        vector<EntityHandle>& ents,
+        vector<long>& gids)
 {
-    Range verts;
-    double *field_values;
+    ErrorCode rval;
+    Range range;
+    if (dim == 0)
+    {
+        rval = mbi->get_entities_by_type(eh, MBVERTEX, range); ERR;
+    }
+    else
+    {
+        rval = mbi->get_entities_by_dimension(eh, dim, range); ERR;
+    }
+    if (pc)
+    {
+        rval = pc->filter_pstatus(range, PSTATUS_NOT_OWNED, PSTATUS_NOT); ERR;
+    }
 
-    mbi->get_entities_by_type(eh, MBVERTEX, verts);
+    Tag gidTag;
+    rval = mbi->tag_get_handle("HANDLEID", sizeof(long), MB_TYPE_OPAQUE, gidTag); ERR;
+    vector<long> unsorted(range.size());
+    if (!range.empty())
+    {
+        rval = mbi->tag_get_data(gidTag, range, &unsorted[0]); ERR;
+    }
 
-    Tag field_tag;
-    int count;
-    mbi->tag_get_handle(tagname, 1, MB_TYPE_DOUBLE, field_tag);
-    mbi->tag_iterate(field_tag, verts.begin(), verts.end(), count, (void *&)field_values);
-    assert(count == (int)verts.size());
+    vector<size_t> idx(range.size());
+    for (size_t i = 0; i < idx.size(); i++)
+        idx[i] = i;
+    sort(idx.begin(), idx.end(), [&](size_t a, size_t b) { return unsorted[a] < unsorted[b]; });
 
-    for(int i = 0; i < (int)verts.size(); i++)
+    ents.resize(idx.size());
+    gids.resize(idx.size());
+    for (size_t i = 0; i < idx.size(); i++)
     {
-        EntityHandle vert = verts[i];
-        double pos[3];
-        mbi->get_coords(&vert, 1, pos);
-        double ref_value = PhysField(pos[0], pos[1], pos[2], factor);
+        ents[i] = range[idx[i]];
+        gids[i] = unsorted[idx[i]];
+    }
+}
 
-        // debug
-        if (debug)
-            fprintf(stderr, "vertex %d: f(%.3lf, %.3lf, %.3lf) = %.3lf "
-                    "ref_value = %.3lf\n",
-                    i, pos[0], pos[1], pos[2], field_values[i], ref_value);
+// selects the entries of sorted global ids (1-based) in a 1-d dataspace, one hyperslab block per run of consecutive ids
+static void select_gids(hid_t space, const vector<long>& gids)
+{
+    H5Sselect_none(space);
+    size_t i = 0;
+    while (i < gids.size())
+    {
+        size_t j = i + 1;
+        while (j < gids.size() && gids[j] == gids[j - 1] + 1)
+            j++;
+        hsize_t start = gids[i] - 1;
+        hsize_t count = j - i;
+        H5Sselect_hyperslab(space, H5S_SELECT_OR, &start, NULL, &count, NULL);
+        i = j;
     }
 }
-// prints mesh statistics (for debugging)
-void PrintMeshStats(Interface *mbint,        // moab interface
-        EntityHandle *mesh_set,  // moab mesh set
-        ParallelComm *mbpc)      // moab parallel communicator
+
+// a fields file that cannot be written would leave the consumer patching stale fields, so the run stops
+static void fields_write_error(const string& filename,
+        const char* what)
+{
+    fmt::print(stderr, "WriteFields: {} failed for {}\n", what, filename);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+// writes the fields of a mesh, without its topology, to an HDF5 file
+// each field is a dataset indexed by global id - 1, written collectively by the owners of the entities, and the file
+// records the version of the mesh topology the fields belong to
+// aborts the run if HDF5 fails
+void WriteFields(Interface *mbi,                    // moab interface
+        ParallelComm *pc,                           // moab communicator
+        EntityHandle eh,                            // mesh set
+        const string& filename,                     // output file name
+        int version,                                // mesh version
+        MPI_Comm comm)                              // communicator
 {
-    Range range;
     ErrorCode rval;
-    static int mesh_num = 0;                 // counts how many time this function is called
-    float loc_verts = 0.0;                   // num local verts (fractional for shared verts)
-    float glo_verts;                         // global number of verts
-    float loc_share_verts = 0.0;             // num local shared verts (fractional)
-    float glo_share_verts;                   // global number of shared verts
-    int loc_cells, glo_cells;                // local and global number of cells (no sharing)
-    int rank;
 
-    MPI_Comm_rank(mbpc->comm(), &rank);
+    hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+    H5Pset_fapl_mpio(fapl, comm, MPI_INFO_NULL);
+    hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+    if (file < 0)
+        fields_write_error(filename, "H5Fcreate");
+
+    hid_t scalar = H5Screate(H5S_SCALAR);
+    hid_t attr = H5Acreate2(file, "mesh_version", H5T_NATIVE_INT, scalar, H5P_DEFAULT, H5P_DEFAULT);
+    if (attr < 0 || H5Awrite(attr, H5T_NATIVE_INT, &version) < 0)
+        fields_write_error(filename, "writing the mesh version");
+    H5Aclose(attr);
+    H5Sclose(scalar);
 
-    // get local quantities
-    range.clear();
-    rval = mbint->get_entities_by_dimension(*mesh_set, 0, range); ERR;
+    hid_t dxpl = H5Pcreate(H5P_DATASET_XFER);
+    H5Pset_dxpl_mpio(dxpl, H5FD_MPIO_COLLECTIVE);
 
-    // compute fractional contribution of shared vertices attributed to this proc
-    int ps[MAX_SHARING_PROCS];               // sharing procs for a vert
-    EntityHandle hs[MAX_SHARING_PROCS];      // handles of shared vert on sharing procs
-    int num_ps = 0;                          // number of sharing procs, returned by moab
-    unsigned char pstat;                     // pstatus, returned by moab
-    for (Range::iterator verts_it = range.begin(); verts_it != range.end();
-            verts_it++)
+    for (auto& field : delta_fields)
     {
-        rval = mbpc->get_sharing_data(*verts_it, ps, hs, pstat, num_ps); ERR;
-        if (num_ps == 0)
-            loc_verts++;
-        else if (num_ps == 1)                // when 2 procs, moab lists only one (the other)
+        vector<EntityHandle> ents;
+        vector<long> gids;
+        sorted_by_gid(mbi, pc, eh, field.second, ents, gids);
+
+        Tag fieldTag;
+        rval = mbi->tag_get_handle(field.first, 1, MB_TYPE_DOUBLE, fieldTag); ERR;
+        vector<double> vals(ents.size());
+        if (!ents.empty())
         {
-            loc_verts += 0.5;
-            loc_share_verts += 0.5;
+            rval = mbi->tag_get_data(fieldTag, &ents[0], ents.size(), &vals[0]); ERR;
         }
-        else
+
+        long nglobal = gids.empty() ? 0 : gids.back();
+        MPI_Allreduce(MPI_IN_PLACE, &nglobal, 1, MPI_LONG, MPI_MAX, comm);
+
+        hsize_t fdim = nglobal;
+        hsize_t mdim = vals.size();
+        hid_t fspace = H5Screate_simple(1, &fdim, NULL);
+        hid_t mspace = H5Screate_simple(1, &mdim, NULL);
+        hid_t dset = H5Dcreate2(file, field.first, H5T_NATIVE_DOUBLE, fspace, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if (dset < 0)
+            fields_write_error(filename, "H5Dcreate2");
+        select_gids(fspace, gids);
+        if (H5Dwrite(dset, H5T_NATIVE_DOUBLE, mspace, fspace, dxpl, vals.data()) < 0)
+            fields_write_error(filename, "H5Dwrite");
+        H5Dclose(dset);
+        H5Sclose(mspace);
+        H5Sclose(fspace);
+    }
+
+    H5Pclose(dxpl);
+    if (H5Fclose(file) < 0)
+        fields_write_error(filename, "H5Fclose");
+    H5Pclose(fapl);
+}
+
+// patches the fields of a mesh loaded at an earlier time step, in place, from a file written by WriteFields
+// each rank reads the values of all its entities, including shared and ghost entities
+// returns false if the file belongs to a different version of the mesh topology, or cannot be read
+bool ReadFields(Interface *mbi,                     // moab interface
+        EntityHandle eh,                            // mesh set
+        const string& filename,                     // input file name
+        int version,                                // version of the loaded mesh
+        MPI_Comm comm,                              // communicator
+        size_t& bytes)                              // (output) number of bytes of field values read
+{
+    ErrorCode rval;
+    bytes = 0;
+
+    hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+    H5Pset_fapl_mpio(fapl, comm, MPI_INFO_NULL);
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, fapl);
+    if (file < 0)
+    {
+        fmt::print(stderr, "ReadFields: H5Fopen failed for {}\n", filename);
+        H5Pclose(fapl);
+        return false;
+    }
+
+    int file_version = -1;
+    hid_t attr = H5Aopen(file, "mesh_version", H5P_DEFAULT);
+    if (attr < 0 || H5Aread(attr, H5T_NATIVE_INT, &file_version) < 0)
+        fmt::print(stderr, "ReadFields: {} has no mesh version\n", filename);
+    else if (file_version != version)
+        fmt::print(stderr, "ReadFields: {} has fields of mesh version {}, but the loaded mesh is version {}\n",
+                filename, file_version, version);
+    if (attr >= 0)
+        H5Aclose(attr);
+    if (file_version != version)
+    {
+        H5Fclose(file);
+        H5Pclose(fapl);
+        return false;
+    }
+
+    hid_t dxpl = H5Pcreate(H5P_DATASET_XFER);
+    H5Pset_dxpl_mpio(dxpl, H5FD_MPIO_COLLECTIVE);
+
+    bool ok = true;
+    for (auto& field : delta_fields)
+    {
+        // fields the consumer did not select are not read (the same on all ranks)
+        Tag fieldTag;
+        if (mbi->tag_get_handle(field.first, 1, MB_TYPE_DOUBLE, fieldTag) != MB_SUCCESS)
+            continue;
+
+        vector<EntityHandle> ents;
+        vector<long> gids;
+        sorted_by_gid(mbi, NULL, eh, field.second, ents, gids);
+
+        hid_t dset = H5Dopen2(file, field.first, H5P_DEFAULT);
+        if (dset < 0)
         {
-            loc_verts += (1.0 / (float)num_ps);
-            loc_share_verts += (1.0 / (float)num_ps);
+            fmt::print(stderr, "ReadFields: {} has no field {}\n", filename, field.first);
+            ok = false;
+            break;
         }
+        hid_t fspace = H5Dget_space(dset);
+        hsize_t mdim = ents.size();
+        hid_t mspace = H5Screate_simple(1, &mdim, NULL);
+        select_gids(fspace, gids);
+        vector<double> vals(ents.size());
+        herr_t status = H5Dread(dset, H5T_NATIVE_DOUBLE, mspace, fspace, dxpl, vals.data());
+        H5Sclose(mspace);
+        H5Sclose(fspace);
+        H5Dclose(dset);
+        if (status < 0)
+        {
+            fmt::print(stderr, "ReadFields: H5Dread failed for field {} of {}\n", field.first, filename);
+            ok = false;
+            break;
+        }
+
+        if (!ents.empty())
+        {
+            rval = mbi->tag_set_data(fieldTag, &ents[0], ents.size(), &vals[0]); ERR;
+        }
+        bytes += vals.size() * sizeof(double);
     }
 
-    range.clear();
-    rval = mbint->get_entities_by_dimension(*mesh_set, 3, range); ERR;
-    loc_cells = (int)range.size();
+    H5Pclose(dxpl);
+    H5Fclose(file);
+    H5Pclose(fapl);
+    return ok;
+}
 
-    // add totals for global quantities
-    MPI_Reduce(&loc_verts, &glo_verts, 1, MPI_FLOAT, MPI_SUM, 0,
-            mbpc->comm());
-    MPI_Reduce(&loc_share_verts, &glo_share_verts, 1, MPI_FLOAT, MPI_SUM, 0,
-            mbpc->comm());
-    MPI_Reduce(&loc_cells, &glo_cells, 1, MPI_INT, MPI_SUM, 0, mbpc->comm());
+// aggregates the phase timers of a task over its ranks, as min, max, mean, and imbalance (max / mean) of the
+// time per rank, prints them, and writes them to <timers_file>_<task>_<trial>.json and <timers_file>_<task>.csv
+// (one row per phase and trial)
+// the CSV file is truncated and gets its header the first time this process writes it, and is appended to after that,
+// whether or not the task reports its setup, and however many times it is set up
+// params.trial < 0 reports the setup of the task, before the first trial
+void ReportPhaseTimers(const PhaseTimers& timers,   // phase timers of this rank
+        const char* task,                           // task name
+        MPI_Comm comm,                              // task communicator
+        const TaskParams& params)                   // task parameters
+{
+    int rank, nprocs;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nprocs);
+
+    double min_time[NUM_PHASES], max_time[NUM_PHASES], sum_time[NUM_PHASES];
+    int max_calls[NUM_PHASES];
+    MPI_Reduce(timers.time, min_time, NUM_PHASES, MPI_DOUBLE, MPI_MIN, 0, comm);
+    MPI_Reduce(timers.time, max_time, NUM_PHASES, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(timers.time, sum_time, NUM_PHASES, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(timers.calls, max_calls, NUM_PHASES, MPI_INT, MPI_MAX, 0, comm);
+    if (rank > 0)
+        return;
+
+    string trial = params.trial < 0 ? string("setup") : to_string(params.trial);
+    FILE* json = NULL;
+    FILE* csv = NULL;
+    bool header = false;
+    if (!params.timers_file.empty())
+    {
+        // CSV files already started by this process (the tasks may report from concurrent threads)
+        static std::set<string> started;
+        static std::mutex started_mutex;
 
-    // report results
-    if (rank == 0)
+        string prefix = fmt::format("{}_{}", params.timers_file, task);
+        {
+            std::lock_guard<std::mutex> lock(started_mutex);
+            header = started.insert(prefix + ".csv").second;
+        }
+        json = fopen(fmt::format("{}_{}.json", prefix, trial).c_str(), "w");
+        csv  = fopen((prefix + ".csv").c_str(), header ? "w" : "a");
+        if (!json || !csv)
+            fmt::print(stderr, "ReportPhaseTimers: cannot write timer files {}_*\n", prefix);
+    }
+    if (json)
+        fmt::print(json, "{{\n  \"task\": \"{}\",\n  \"trial\": \"{}\",\n  \"nprocs\": {},\n  \"phases\": [",
+                task, trial, nprocs);
+    if (csv && header)
+        fmt::print(csv, "task,trial,nprocs,phase,calls,min,max,mean,imbalance\n");
+
+    fmt::print(stderr, "{} {} phase times (s) over {} ranks:\n", task,
+            params.trial < 0 ? trial : "trial " + trial, nprocs);
+    bool first = true;
+    for (int p = 0; p < NUM_PHASES; p++)
     {
-        fmt::print(stderr, "----------------- Mesh {} statistics -----------------\n", mesh_num);
-        fmt::print(stderr, "Total number of verts = {} of which {} "
-                "are shared\n", glo_verts, glo_share_verts);
-        fmt::print(stderr, "Total number of cells = {}\n", glo_cells);
-        fmt::print(stderr, "------------------------------------------------------\n");
+        if (max_calls[p] == 0)
+            continue;
+        double mean = sum_time[p] / nprocs;
+        double imbalance = mean > 0 ? max_time[p] / mean : 1.0;
+        fmt::print(stderr, "  {:<12} calls {:>4} min {:.4f} max {:.4f} mean {:.4f} imbalance {:.3f}\n",
+                PhaseName(p), max_calls[p], min_time[p], max_time[p], mean, imbalance);
+        if (json)
+            fmt::print(json, "{}\n    {{ \"phase\": \"{}\", \"calls\": {}, \"min\": {:.6f}, \"max\": {:.6f}, "
+                    "\"mean\": {:.6f}, \"imbalance\": {:.4f} }}",
+                    first ? "" : ",", PhaseName(p), max_calls[p], min_time[p], max_time[p], mean, imbalance);
+        if (csv)
+            fmt::print(csv, "{},{},{},{},{},{:.6f},{:.6f},{:.6f},{:.4f}\n",
+                    task, trial, nprocs, PhaseName(p), max_calls[p], min_time[p], max_time[p], mean, imbalance);
+        first = false;
     }
 
-    mesh_num = (mesh_num + 1) % 2;
+    if (json)
+    {
+        fmt::print(json, "\n  ]\n}}\n");
+        fclose(json);
+    }
+    if (csv)
+        fclose(csv);
 }
 
-// prepares the mesh by decomposing source domain and creating mesh in situ
-void PrepMesh(int src_type,
-              int src_size,
-              int slab,
-              Interface* mbi,
-              ParallelComm* pc,
-              EntityHandle root,
-              double factor,
-              bool debug)
+// total number of blocks in the decomposition of the producer mesh
+// default is 1 block per process
+// structured boxes cannot share vertices with other local boxes, and ghost layers of local blocks would overlap,
+// so these support only 1 block per process
+static int num_blocks(int src_type,                 // mesh type (0 = hex, 1 = tet, 2 = structured hex)
+        int tot_blocks,                             // requested number of blocks (-1 = one per process)
+        int nprocs,                                 // number of processes
+        int ghost = 0)                              // number of ghost layers
+{
+    tot_blocks = std::max(tot_blocks, nprocs);
+    if (src_type == 2 || ghost > 0)
+        tot_blocks = nprocs;
+    return tot_blocks;
+}
+
+// decomposes the domain of a cubic mesh into nblocks blocks, with ghost layers of the given width
+diy::RegularDecomposer<Bounds> decompose_domain(int src_size,   // mesh size (vertices) per side
+        int slab,                                               // block shape (0 = cubes; 1 = slabs)
+        int nblocks,                                            // total number of blocks
+        int ghost)                                              // number of ghost layers
 {
-    diy::RegularDecomposer<Bounds>::CoordinateVector    ghost(3, 0);
+    diy::RegularDecomposer<Bounds>::CoordinateVector    ghosts(3, ghost);
     diy::RegularDecomposer<Bounds>::DivisionsVector     given(3, 0);
     std::vector<bool>                                   share_face(3, true);
     std::vector<bool>                                   wrap(3, false);
 
-    diy::mpi::communicator comm = pc->comm();
-
-    int src_mesh_size[3]  = {src_size, src_size, src_size};      // source size
     Bounds domain(3);
     domain.min[0] = domain.min[1] = domain.min[2] = 0;
     domain.max[0] = domain.max[1] = domain.max[2] = src_size - 1;
 
-    // decompose domain
     if (slab == 1)
     {
         // blocks are slabs in the z direction
         given[1] = 1;
     }
 
-    // the following calls to asssigners are for 1 block per process
-    diy::RoundRobinAssigner         assigner(comm.size(), comm.size());
-    diy::RegularDecomposer<Bounds>  decomposer(3,
-                                               domain,
-                                               assigner.nblocks(),
-                                               share_face,
-                                               wrap,
-                                               ghost,
-                                               given);
+    return diy::RegularDecomposer<Bounds>(3, domain, nblocks, share_face, wrap, ghosts, given);
+}
+
+// prepares the mesh by decomposing source domain and creating mesh in situ
+void PrepMesh(int src_type,
+              int src_size,
+              int slab,
+              const TaskParams& params,
+              Interface* mbi,
+              ParallelComm* pc,
+              EntityHandle root,
+              double factor,
+              bool debug)
+{
+    diy::mpi::communicator comm = pc->comm();
+
+    int src_mesh_size[3]  = {src_size, src_size, src_size};      // source size
+
+    // decompose domain
+    int tot_blocks = num_blocks(src_type, params.tot_blocks, comm.size(), params.ghost);
+    if (tot_blocks < params.tot_blocks && comm.rank() == 0)
+        fmt::print(stderr, "Structured mesh and ghost layers support only one block per process, ignoring {} blocks\n",
+                params.tot_blocks);
+    diy::RoundRobinAssigner         assigner(comm.size(), tot_blocks);
+    diy::RegularDecomposer<Bounds>  decomposer = decompose_domain(src_size, slab, assigner.nblocks(), params.ghost);
 
     // report the number of blocks in each dimension of each mesh
     if (comm.rank() == 0)
@@ -701,17 +2385,194 @@ void PrepMesh(int src_type,
         pc->set_debug_verbosity(5);
 
     if (src_type == 0)
-        hex_mesh_gen(src_mesh_size, mbi, &root, pc, decomposer, assigner);
+        hex_mesh_gen(src_mesh_size, mbi, &root, pc, decomposer, assigner, params);
+    else if (src_type == 1)
+        tet_mesh_gen(src_mesh_size, mbi, &root, pc, decomposer, assigner, params);
     else
-        tet_mesh_gen(src_mesh_size, mbi, &root, pc, decomposer, assigner);
-
+        scd_mesh_gen(src_mesh_size, mbi, &root, pc, decomposer, assigner, params);
 
-    // debug: print mesh stats
-    PrintMeshStats(mbi, &root, pc);
+    // mesh statistics, including memory use
+    if (params.stats)
+    {
+        PhaseTimer stats(params.timers, PHASE_STATS);
+        PrintMeshStats(mbi, &root, pc);
+    }
 
     // add field to input mesh
-    PutVertexField(mbi, root, "vertex_field", factor);
-    PutElementField(mbi, root, "element_field", factor);
+    PhaseTimer fields(params.timers, PHASE_FIELDS);
+    PutVertexField(mbi, root, "vertex_field", factor, params.threads);
+    PutElementField(mbi, root, "element_field", factor, params.threads);
+}
+
+// number of z-slabs in which the producer mesh is streamed, so that one slab of the local blocks of any process fits
+// within params.mem_budget
+// the memory of a slab is estimated from the number of its vertices and cells, counting coordinates, connectivity,
+// global id and field tags, and vertex-to-cell adjacencies
+// optionally returns the number of z-layers of cells in each slab (the last slab may have fewer)
+int StreamSlabs(const TaskParams& params,           // task parameters
+        int nprocs,                                 // number of producer processes
+        int* layers)                                // (output, optional) number of z-layers of cells per slab
+{
+    int src_size = params.mesh_size;
+    int nlayers  = src_size - 1;                    // whole mesh in one slab
+
+    if (params.mem_budget > 0)
+    {
+        // estimated bytes per vertex and per cell, by mesh type (hex, tet, structured hex), counted from what moab
+        // stores for them, without the HDF5 write buffers or the baseline of the process:
+        // hex: vertex = coordinates 24 + global id 8 + field 8 + adjacencies to ~8 cells 64, rounded up to 128;
+        //      cell = connectivity 8 x 8 + global id 8 + field 8 = 80
+        // tet: vertex as hex, with adjacencies to ~24 tets, rounded up to 256; 6 tets per grid space, each
+        //      connectivity 4 x 8 + global id 8 + field 8 = 48
+        // structured hex: implicit connectivity and no adjacencies; vertex = 24 + 8 + 8 = 40, cell = 8 + 8 = 16
+        // the budget is therefore an estimate; StreamMesh reports the memory actually used per slab against it
+        static const double vert_bytes[3] = {128.0, 256.0, 40.0};
+        static const double cell_bytes[3] = {80.0, 6 * 48.0, 16.0};
+        int t = std::min(std::max(params.mesh_type, 0), 2);
+
+        // bytes per z-layer of the local blocks of the most loaded process
+        int tot_blocks = num_blocks(params.mesh_type, params.tot_blocks, nprocs);
+        diy::RegularDecomposer<Bounds> decomp = decompose_domain(src_size, params.mesh_slab, tot_blocks);
+        std::vector<double> layer_bytes(nprocs, 0.0);
+        for (int gid = 0; gid < tot_blocks; gid++)
+        {
+            Bounds core(3);
+            decomp.fill_bounds(core, gid);
+            double nx = core.max[0] - core.min[0] + 1;
+            double ny = core.max[1] - core.min[1] + 1;
+            layer_bytes[gid % nprocs] += nx * ny * vert_bytes[t] + (nx - 1) * (ny - 1) * cell_bytes[t];
+        }
+        double max_bytes = *std::max_element(layer_bytes.begin(), layer_bytes.end());
+
+        // one more layer of vertices than cells per slab
+        nlayers = (int)(params.mem_budget * 1048576.0 / max_bytes) - 1;
+        nlayers = std::min(std::max(nlayers, 1), src_size - 1);
+    }
+
+    if (layers)
+        *layers = nlayers;
+    return (src_size - 2) / nlayers + 1;
+}
+
+// names of the files holding the producer mesh, in the order they are written: filename itself, one file per z-slab
+// when streaming, or one file per time step
+std::vector<std::string> MeshFilenames(const std::string& filename,       // name of the file for a single mesh
+        const TaskParams& params,                                         // task parameters
+        int nprocs)                                                       // number of producer processes
+{
+    std::vector<std::string> names;
+    if (params.mem_budget > 0)
+    {
+        int nslabs = StreamSlabs(params, nprocs);
+        for (int s = 0; s < nslabs; s++)
+            names.push_back(StreamFilename(filename, s));
+    }
+    else if (NumSteps(params) > 1)
+    {
+        for (int k = 0; k < NumSteps(params); k++)
+            names.push_back(DeltaStep(params, k) ? FieldsFilename(filename, k) : StepFilename(filename, k));
+    }
+    else
+        names.push_back(filename);
+    return names;
 }
 
+// generates the producer mesh out of core, in z-slabs whose memory is bounded by params.mem_budget
+// each slab is generated in its own moab instance from the intersection of the local blocks with the slab,
+// written to its own file (moab cannot append to an existing file), and released before the next slab is generated
+// consecutive slabs share their bounding plane of vertices, which appear in both files with the same global ids
+void StreamMesh(const TaskParams& params,       // task parameters
+        MPI_Comm comm_,                         // producer communicator
+        double factor,                          // scaling factor on field values
+        const std::string& outfile,             // name of the output file when not streaming
+        const std::string& write_opts)          // moab write options
+{
+    diy::mpi::communicator comm(comm_);
+
+    int src_type          = params.mesh_type;
+    int src_size          = params.mesh_size;
+    int src_mesh_size[3]  = {src_size, src_size, src_size};      // source size
+
+    // decompose domain
+    int tot_blocks = num_blocks(src_type, params.tot_blocks, comm.size());
+    diy::RoundRobinAssigner         assigner(comm.size(), tot_blocks);
+    diy::RegularDecomposer<Bounds>  decomposer = decompose_domain(src_size, params.mesh_slab, assigner.nblocks());
+
+    int layers;
+    int nslabs = StreamSlabs(params, comm.size(), &layers);
+    if (comm.rank() == 0)
+    {
+        fmt::print(stderr, "Streaming the source mesh in {} z-slabs of {} layers within {} MB per process\n",
+                nslabs, layers, params.mem_budget);
+        if (params.ghost > 0)
+            fmt::print(stderr, "Ghost layers are not generated when streaming the mesh\n");
+    }
 
+    for (int s = 0; s < nslabs; s++)
+    {
+        int z0 = s * layers;                                    // first and last z-plane of vertices of the slab
+        int z1 = std::min(z0 + layers, src_size - 1);
+
+        Interface*      mbi = new Core();
+        ParallelComm*   pc  = new ParallelComm(mbi, comm);
+        EntityHandle    root;
+        ErrorCode       rval;
+        rval = mbi->create_meshset(MESHSET_SET, root); ERR;
+
+        // local blocks clipped to the slab, keeping the global ids of the blocks
+        PhaseTimer generate(params.timers, PHASE_GENERATE);
+        diy::Master master(comm, params.threads, -1, &MeshBlock::create, &MeshBlock::destroy);
+        init_blocks(master, decomposer, assigner, comm.rank(), z0, z1);
+
+        if (src_type == 0)
+            create_hexes_and_verts(src_mesh_size, mbi, &root, master, pc, params.order);
+        else if (src_type == 1)
+            create_tets_and_verts(src_mesh_size, mbi, &root, master, pc, params.order);
+        else
+            create_scd_hexes_and_verts(src_mesh_size, mbi, &root, master, pc);
+        generate.stop();
+
+        // clipped blocks no longer follow the decomposition in z, so sharing is resolved by moab
+        PhaseTimer resolve(params.timers, PHASE_RESOLVE);
+        resolve_and_exchange(mbi, &root, pc);
+        resolve.stop();
+
+        PhaseTimer fields(params.timers, PHASE_FIELDS);
+        PutVertexField(mbi, root, "vertex_field", factor, params.threads);
+        PutElementField(mbi, root, "element_field", factor, params.threads);
+        fields.stop();
+
+        if (params.stats)
+        {
+            PhaseTimer stats(params.timers, PHASE_STATS);
+            PrintMeshStats(mbi, &root, pc);
+        }
+
+        if (params.handoff)
+        {
+            PhaseTimer wait(params.timers, PHASE_WAIT);
+            params.handoff->begin_write(s);
+        }
+        PhaseTimer write(params.timers, PHASE_WRITE);
+        rval = mbi->write_file(StreamFilename(outfile, s).c_str(), 0, write_opts.c_str(), &root, 1); ERR;
+        write.stop();
+        if (params.handoff)
+            params.handoff->end_write(s);
+
+        // memory of the slab against the budget: moab's estimate of the slab instance, and the peak resident set
+        // size of the process so far (ru_maxrss, in KB on Linux; it includes the baseline of the process, and in
+        // shared mode the consumer)
+        unsigned long long mem;
+        mbi->estimated_memory_use(0, 0, &mem);
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        double mb[2] = { mem / 1048576.0, usage.ru_maxrss / 1024.0 };
+        MPI_Allreduce(MPI_IN_PLACE, mb, 2, MPI_DOUBLE, MPI_MAX, comm);
+        if (comm.rank() == 0)
+            fmt::print(stderr, "slab {}: moab memory {:.1f} MB, peak RSS {:.1f} MB per process (max), "
+                    "budget {} MB{}\n", s, mb[0], mb[1], params.mem_budget, mb[0] > params.mem_budget ? " (over budget)" : "");
+
+        delete pc;
+        delete mbi;
+    }
+}
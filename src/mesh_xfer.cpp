@@ -0,0 +1,1392 @@
+#include <unordered_map>
+#include <zlib.h>
+#include "prod-con.hpp"
+
+using namespace std;
+using namespace moab;
+
+// pointers to the arrays of a packed mesh (the topology arrays are null if only the fields are packed)
+struct MeshArrays
+{
+    long*       vert_gids   = NULL;
+    double*     coords      = NULL;
+    long*       cell_gids   = NULL;
+    long*       conn        = NULL;
+    double*     vert_field  = NULL;
+    double*     cell_field  = NULL;
+    char*       sets        = NULL;
+
+    MeshArrays(const MeshHeader& hdr, char* buf)
+    {
+        char* p = buf + sizeof(MeshHeader);
+        if (hdr.topology)
+        {
+            vert_gids   = (long*)p;     p += hdr.nverts * 8;
+            coords      = (double*)p;   p += hdr.nverts * 3 * 8;
+            cell_gids   = (long*)p;     p += hdr.ncells * 8;
+            conn        = (long*)p;     p += hdr.ncells * hdr.verts_per_cell * 8;
+        }
+        if (hdr.vert_field)
+        {
+            vert_field  = (double*)p;   p += hdr.nverts * 8;
+        }
+        if (hdr.cell_field)
+            cell_field  = (double*)p;
+        if (hdr.sets)
+            sets        = buf + hdr.bytes() - hdr.sets;
+    }
+};
+
+// appends n values to a byte stream
+template<class T>
+static void put(vector<char>& out, const T* v, size_t n = 1)
+{
+    const char* p = (const char*)v;
+    out.insert(out.end(), p, p + n * sizeof(T));
+}
+
+// reads n values from a byte stream, and advances it
+template<class T>
+static void get(const char*& p, T* v, size_t n = 1)
+{
+    if (n)
+        memcpy(v, p, n * sizeof(T));
+    p += n * sizeof(T);
+}
+
+// packs the vertices and cells of a mesh set, with their global ids and fields, or only the fields, into buf
+// only the cells and fields in select are packed, and a field is packed only if the mesh has it
+// with the topology, the sets and other tags packed by PackSets may follow
+// returns the size of the packed mesh; buf = NULL only computes the size
+size_t PackMesh(Interface* mbi,                     // moab interface
+        EntityHandle eh,                            // mesh set
+        int version,                                // mesh version
+        bool topology,                              // pack the vertices and cells, not only the fields
+        const MeshSelect& select,                   // cells and fields to pack
+        char* buf,                                  // (output) packed mesh, MeshHeader::bytes() long, or NULL
+        const vector<char>* sets)                   // sets and tags from PackSets, or NULL
+{
+    ErrorCode rval;
+    Range verts, cells;
+    rval = mbi->get_entities_by_type(eh, MBVERTEX, verts); ERR;
+    if (select.dim >= 3)
+    {
+        rval = mbi->get_entities_by_dimension(eh, 3, cells); ERR;
+    }
+
+    Tag vertTag, cellTag;
+    bool vert_field = select.tag("vertex_field") &&
+        mbi->tag_get_handle("vertex_field", 1, MB_TYPE_DOUBLE, vertTag) == MB_SUCCESS;
+    bool cell_field = select.tag("element_field") && !cells.empty() &&
+        mbi->tag_get_handle("element_field", 1, MB_TYPE_DOUBLE, cellTag) == MB_SUCCESS;
+
+    MeshHeader hdr;
+    hdr.version         = version;
+    hdr.topology        = topology ? 1 : 0;
+    hdr.nverts          = verts.size();
+    hdr.ncells          = cells.size();
+    hdr.cell_type       = cells.empty() ? MBMAXTYPE : mbi->type_from_handle(cells.front());
+    hdr.verts_per_cell  = 0;
+    hdr.vert_field      = vert_field ? 1 : 0;
+    hdr.cell_field      = cell_field ? 1 : 0;
+    hdr.sets            = topology && sets ? sets->size() : 0;
+    vector<EntityHandle> conn;
+    if (topology && !cells.empty())
+    {
+        vector<EntityHandle> handles;
+        handles.reserve(cells.size());
+        for (Range::iterator it = cells.begin(); it != cells.end(); ++it)
+            handles.push_back(*it);
+        rval = mbi->get_connectivity(&handles[0], handles.size(), conn); ERR;
+        hdr.verts_per_cell = conn.size() / cells.size();
+    }
+    if (!buf)
+        return hdr.bytes();
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    MeshArrays arrays(hdr, buf);
+
+    if (topology)
+    {
+        // the global ids are the only way to match entities across ranks, so a mesh without them cannot be packed
+        Tag gidTag;
+        rval = mbi->tag_get_handle("HANDLEID", sizeof(long), MB_TYPE_OPAQUE, gidTag);
+        if (rval != MB_SUCCESS)
+        {
+            fmt::print(stderr, "PackMesh: the mesh has no HANDLEID global ids\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (!verts.empty())
+        {
+            rval = mbi->tag_get_data(gidTag, verts, arrays.vert_gids); ERR;
+            rval = mbi->get_coords(verts, arrays.coords); ERR;
+        }
+        if (!cells.empty())
+        {
+            rval = mbi->tag_get_data(gidTag, cells, arrays.cell_gids); ERR;
+            rval = mbi->tag_get_data(gidTag, &conn[0], conn.size(), arrays.conn); ERR;
+        }
+    }
+
+    if (vert_field && !verts.empty())
+    {
+        rval = mbi->tag_get_data(vertTag, verts, arrays.vert_field); ERR;
+    }
+    if (cell_field)
+    {
+        rval = mbi->tag_get_data(cellTag, cells, arrays.cell_field); ERR;
+    }
+    if (hdr.sets)
+        memcpy(arrays.sets, &(*sets)[0], hdr.sets);
+
+    return hdr.bytes();
+}
+
+// sets contained in a mesh set that the consumer selected: those with one of the tags in select.sets, and the part sets
+static Range selected_sets(Interface* mbi,
+        EntityHandle eh,
+        const MeshSelect& select)
+{
+    ErrorCode rval;
+    Range sets;
+    if (select.sets.empty())
+    {
+        rval = mbi->get_entities_by_type(eh, MBENTITYSET, sets); ERR;
+        return sets;
+    }
+    vector<string> names = select.sets;
+    names.push_back("PARALLEL_PARTITION");
+    for (const string& name : names)
+    {
+        Tag tag;
+        if (mbi->tag_get_handle(name.c_str(), tag) != MB_SUCCESS)
+            continue;
+        Range tagged;
+        rval = mbi->get_entities_by_type_and_tag(eh, MBENTITYSET, &tag, NULL, 1, tagged); ERR;
+        sets.merge(tagged);
+    }
+    return sets;
+}
+
+// packs the sets contained in a mesh set, and the tags of the mesh that PackMesh does not pack, into out
+// a set is packed if selected, with its options, contents, and children, as positions in the packed vertices, cells,
+// and sets; contents and children that are not packed are left out
+// a tag is packed if it is selected (PARALLEL_PARTITION always is), of fixed length, and of integer, double, or opaque type, with its values on the
+// packed sets, vertices, and cells that have it (positions are left out if all of them have it)
+// returns the size of the packed sets and tags
+size_t PackSets(Interface* mbi,                     // moab interface
+        EntityHandle eh,                            // mesh set
+        const MeshSelect& select,                   // cells and tags to pack
+        vector<char>& out)                          // (output) packed sets and tags
+{
+    ErrorCode rval;
+    Range groups[3];                                // sets, vertices, and cells, in the order of PackMesh
+    groups[0] = selected_sets(mbi, eh, select);
+    rval = mbi->get_entities_by_type(eh, MBVERTEX, groups[1]); ERR;
+    if (select.dim >= 3)
+    {
+        rval = mbi->get_entities_by_dimension(eh, 3, groups[2]); ERR;
+    }
+    out.clear();
+
+    // sets
+    long nsets = groups[0].size();
+    put(out, &nsets);
+    for (Range::iterator it = groups[0].begin(); it != groups[0].end(); ++it)
+    {
+        unsigned int options;
+        Range contents;
+        vector<EntityHandle> children;
+        rval = mbi->get_meshset_options(*it, options); ERR;
+        rval = mbi->get_entities_by_handle(*it, contents); ERR;
+        rval = mbi->get_child_meshsets(*it, children); ERR;
+
+        vector<long> pos[4];                        // vertices, cells, and sets in the set, and child sets
+        for (Range::iterator c = contents.begin(); c != contents.end(); ++c)
+        {
+            EntityType type = mbi->type_from_handle(*c);
+            int g = type == MBENTITYSET ? 0 : type == MBVERTEX ? 1 : 2;
+            long i = groups[g].index(*c);
+            if (i >= 0)
+                pos[g == 0 ? 2 : g - 1].push_back(i);
+        }
+        for (EntityHandle child : children)
+        {
+            long i = groups[0].index(child);
+            if (i >= 0)
+                pos[3].push_back(i);
+        }
+
+        long counts[5] = { (long)options, (long)pos[0].size(), (long)pos[1].size(), (long)pos[2].size(),
+            (long)pos[3].size() };
+        put(out, counts, 5);
+        for (int j = 0; j < 4; j++)
+            put(out, pos[j].data(), pos[j].size());
+    }
+
+    // tags
+    vector<Tag> tags;
+    rval = mbi->tag_get_tags(tags); ERR;
+    size_t ntags_pos = out.size();
+    long ntags = 0;
+    put(out, &ntags);
+    for (Tag tag : tags)
+    {
+        string name;
+        DataType type;
+        TagType storage;
+        int length, bytes;
+        rval = mbi->tag_get_name(tag, name); ERR;
+        rval = mbi->tag_get_data_type(tag, type); ERR;
+        rval = mbi->tag_get_type(tag, storage); ERR;
+        if (name.compare(0, 2, "__") == 0 || name == "HANDLEID" || name == "MESH_VERSION" ||
+                name == "vertex_field" || name == "element_field" ||
+                (!select.tag(name) && name != "PARALLEL_PARTITION") ||
+                (type != MB_TYPE_INTEGER && type != MB_TYPE_DOUBLE && type != MB_TYPE_OPAQUE) ||
+                mbi->tag_get_length(tag, length) != MB_SUCCESS || mbi->tag_get_bytes(tag, bytes) != MB_SUCCESS)
+            continue;
+
+        // entities of each group with the tag
+        Range tagged[3];
+        bool any = false;
+        for (int g = 0; g < 3; g++)
+        {
+            if (groups[g].empty())
+                continue;
+            Range ents;
+            rval = mbi->get_entities_by_type_and_tag(0, mbi->type_from_handle(groups[g].front()), &tag, NULL, 1,
+                    ents); ERR;
+            tagged[g] = intersect(ents, groups[g]);
+            any |= !tagged[g].empty();
+        }
+        if (!any)
+            continue;
+
+        long name_len = name.size();
+        vector<char> def(bytes);
+        long desc[5] = { (long)type, (long)length, (long)bytes, storage == MB_TAG_SPARSE ? 1L : 0L,
+            mbi->tag_get_default_value(tag, &def[0]) == MB_SUCCESS ? 1L : 0L };
+        put(out, &name_len);
+        put(out, name.data(), name.size());
+        put(out, desc, 5);
+        if (desc[4])
+            put(out, &def[0], bytes);
+
+        for (int g = 0; g < 3; g++)
+        {
+            long count[2] = { (long)tagged[g].size(), tagged[g].size() == groups[g].size() ? 1L : 0L };
+            put(out, count, 2);
+            if (!count[0])
+                continue;
+            if (!count[1])
+                for (Range::iterator it = tagged[g].begin(); it != tagged[g].end(); ++it)
+                {
+                    long i = groups[g].index(*it);
+                    put(out, &i);
+                }
+            vector<char> values(count[0] * bytes);
+            rval = mbi->tag_get_data(tag, tagged[g], &values[0]); ERR;
+            put(out, &values[0], values.size());
+        }
+        ntags++;
+    }
+    memcpy(&out[ntags_pos], &ntags, sizeof(long));
+
+    return out.size();
+}
+
+// creates the sets and tags packed by PackSets for packed mesh s, whose vertices and cells are already created
+// returns the sets created
+static vector<EntityHandle> unpack_sets(Interface* mbi,
+        EntityHandle eh,                            // mesh set
+        const char* p,                              // packed sets and tags
+        const MeshIndex& index,                     // entities created from each packed mesh
+        size_t s)                                   // packed mesh
+{
+    ErrorCode rval;
+
+    // sets, then their contents and children, which may be sets packed after them
+    long nsets;
+    get(p, &nsets);
+    vector<EntityHandle> sets(nsets);
+    vector<vector<long>> set_sets(nsets), set_children(nsets);
+    for (long i = 0; i < nsets; i++)
+    {
+        long counts[5];
+        get(p, counts, 5);
+        rval = mbi->create_meshset((unsigned int)counts[0], sets[i]); ERR;
+
+        vector<long> pos;
+        vector<EntityHandle> contents;
+        for (int j = 0; j < 2; j++)
+        {
+            pos.resize(counts[1 + j]);
+            get(p, pos.data(), pos.size());
+            const vector<EntityHandle>& ents = j == 0 ? index.verts[s] : index.cells[s];
+            for (long k : pos)
+                contents.push_back(ents[k]);
+        }
+        if (!contents.empty())
+        {
+            rval = mbi->add_entities(sets[i], &contents[0], contents.size()); ERR;
+        }
+        set_sets[i].resize(counts[3]);
+        get(p, set_sets[i].data(), set_sets[i].size());
+        set_children[i].resize(counts[4]);
+        get(p, set_children[i].data(), set_children[i].size());
+    }
+    for (long i = 0; i < nsets; i++)
+    {
+        for (long k : set_sets[i])
+        {
+            rval = mbi->add_entities(sets[i], &sets[k], 1); ERR;
+        }
+        for (long k : set_children[i])
+        {
+            rval = mbi->add_child_meshset(sets[i], sets[k]); ERR;
+        }
+    }
+    if (nsets)
+    {
+        rval = mbi->add_entities(eh, &sets[0], nsets); ERR;
+    }
+
+    // tags
+    long ntags;
+    get(p, &ntags);
+    for (long t = 0; t < ntags; t++)
+    {
+        long name_len, desc[5];
+        get(p, &name_len);
+        string name(p, name_len);
+        p += name_len;
+        get(p, desc, 5);
+        vector<char> def(desc[2]);
+        if (desc[4])
+            get(p, &def[0], def.size());
+
+        // a tag that already exists (GLOBAL_ID always does) is used as it is, with its own storage and default, if its
+        // values have the same type and size; otherwise its values are skipped
+        Tag tag;
+        bool usable = true;
+        if (mbi->tag_get_handle(name.c_str(), tag) == MB_SUCCESS)
+        {
+            DataType type;
+            int bytes;
+            usable = mbi->tag_get_data_type(tag, type) == MB_SUCCESS && type == (DataType)desc[0] &&
+                mbi->tag_get_bytes(tag, bytes) == MB_SUCCESS && bytes == desc[2];
+            if (!usable)
+                fmt::print(stderr, "UnpackMesh: tag {} exists with a different type or size, its values are skipped\n",
+                        name);
+        }
+        else
+        {
+            rval = mbi->tag_get_handle(name.c_str(), desc[1], (DataType)desc[0], tag,
+                    (desc[3] ? MB_TAG_SPARSE : MB_TAG_DENSE) | MB_TAG_CREAT, desc[4] ? &def[0] : NULL); ERR;
+            usable = rval == MB_SUCCESS;
+        }
+
+        for (int g = 0; g < 3; g++)
+        {
+            long count[2];
+            get(p, count, 2);
+            if (!count[0])
+                continue;
+            const vector<EntityHandle>& ents = g == 0 ? sets : g == 1 ? index.verts[s] : index.cells[s];
+            vector<EntityHandle> handles(count[0]);
+            for (long i = 0; i < count[0]; i++)
+            {
+                long k = i;
+                if (!count[1])
+                    get(p, &k);
+                handles[i] = ents[k];
+            }
+            if (usable)
+            {
+                rval = mbi->tag_set_data(tag, &handles[0], count[0], p); ERR;
+            }
+            p += count[0] * desc[2];
+        }
+    }
+    return sets;
+}
+
+// creates the mesh packed by the producer ranks of this consumer rank in an empty mesh set, and resolves the entities
+// shared with other consumer ranks
+// entities packed by several producer ranks (shared or ghost entities) are created once, identified by global id
+void UnpackMesh(Interface* mbi,                     // moab interface
+        ParallelComm* pc,                           // moab communicator
+        EntityHandle eh,                            // mesh set
+        const vector<const char*>& bufs,            // packed meshes, with their topology
+        MeshIndex& index)                           // (output) entities created from each packed mesh
+{
+    ErrorCode rval;
+    ReadUtilIface *iface;
+    rval = mbi->query_interface(iface); ERR;
+
+    vector<MeshHeader> hdrs(bufs.size());
+    vector<MeshArrays> arrays;
+    long cell_type = MBMAXTYPE, verts_per_cell = 0;
+    bool has_vert_field = false, has_cell_field = false;        // some packed mesh has the field
+    for (size_t s = 0; s < bufs.size(); s++)
+    {
+        memcpy(&hdrs[s], bufs[s], sizeof(MeshHeader));
+        arrays.emplace_back(hdrs[s], const_cast<char*>(bufs[s]));
+        has_vert_field |= hdrs[s].vert_field != 0;
+        has_cell_field |= hdrs[s].cell_field != 0;
+        if (hdrs[s].ncells)
+        {
+            cell_type       = hdrs[s].cell_type;
+            verts_per_cell  = hdrs[s].verts_per_cell;
+        }
+    }
+
+    // distinct vertices and cells, numbered in the order in which they are first found
+    unordered_map<long, long> vert_idx, cell_idx;
+    vector<pair<int, long>> first_vert, first_cell;         // (packed mesh, position) of each distinct entity
+    for (size_t s = 0; s < bufs.size(); s++)
+    {
+        for (long i = 0; i < hdrs[s].nverts; i++)
+            if (vert_idx.emplace(arrays[s].vert_gids[i], (long)first_vert.size()).second)
+                first_vert.emplace_back(s, i);
+        for (long i = 0; i < hdrs[s].ncells; i++)
+            if (cell_idx.emplace(arrays[s].cell_gids[i], (long)first_cell.size()).second)
+                first_cell.emplace_back(s, i);
+    }
+
+    // vertices
+    EntityHandle startv = 0;
+    vector<double*> coords;
+    vector<long> vert_gids(first_vert.size());
+    vector<double> vert_field(first_vert.size());
+    if (!first_vert.empty())
+    {
+        rval = iface->get_node_coords(3, first_vert.size(), 0, startv, coords); ERR;
+        for (size_t v = 0; v < first_vert.size(); v++)
+        {
+            const MeshArrays& a = arrays[first_vert[v].first];
+            long i = first_vert[v].second;
+            coords[0][v]    = a.coords[3 * i];
+            coords[1][v]    = a.coords[3 * i + 1];
+            coords[2][v]    = a.coords[3 * i + 2];
+            vert_gids[v]    = a.vert_gids[i];
+            vert_field[v]   = a.vert_field ? a.vert_field[i] : 0.;
+        }
+    }
+
+    // cells, with their connectivity mapped from vertex global ids to the vertices just created
+    EntityHandle startc = 0;
+    EntityHandle* conn = NULL;
+    vector<long> cell_gids(first_cell.size());
+    vector<double> cell_field(first_cell.size());
+    if (!first_cell.empty())
+    {
+        rval = iface->get_element_connect(first_cell.size(), verts_per_cell, (EntityType)cell_type, 0, startc, conn); ERR;
+        for (size_t c = 0; c < first_cell.size(); c++)
+        {
+            const MeshArrays& a = arrays[first_cell[c].first];
+            long i = first_cell[c].second;
+            for (int v = 0; v < verts_per_cell; v++)
+                conn[c * verts_per_cell + v] = startv + vert_idx[a.conn[i * verts_per_cell + v]];
+            cell_gids[c]    = a.cell_gids[i];
+            cell_field[c]   = a.cell_field ? a.cell_field[i] : 0.;
+        }
+        rval = iface->update_adjacencies(startc, first_cell.size(), verts_per_cell, conn); ERR;
+    }
+    rval = mbi->release_interface(iface); ERR;
+
+    // global ids and fields
+    Tag gidTag, vertTag, cellTag;
+    const double defVal = 0.;
+    rval = mbi->tag_get_handle("HANDLEID", sizeof(long), MB_TYPE_OPAQUE, gidTag, MB_TAG_CREAT|MB_TAG_DENSE); ERR;
+    if (has_vert_field)
+    {
+        rval = mbi->tag_get_handle("vertex_field", 1, MB_TYPE_DOUBLE, vertTag, MB_TAG_DENSE|MB_TAG_CREAT, &defVal); ERR;
+    }
+    if (has_cell_field)
+    {
+        rval = mbi->tag_get_handle("element_field", 1, MB_TYPE_DOUBLE, cellTag, MB_TAG_DENSE|MB_TAG_CREAT, &defVal); ERR;
+    }
+    if (!first_vert.empty())
+    {
+        Range verts(startv, startv + first_vert.size() - 1);
+        rval = mbi->tag_set_data(gidTag, verts, &vert_gids[0]); ERR;
+        if (has_vert_field)
+        {
+            rval = mbi->tag_set_data(vertTag, verts, &vert_field[0]); ERR;
+        }
+        rval = mbi->add_entities(eh, verts); ERR;
+    }
+    if (!first_cell.empty())
+    {
+        Range cells(startc, startc + first_cell.size() - 1);
+        rval = mbi->tag_set_data(gidTag, cells, &cell_gids[0]); ERR;
+        if (has_cell_field)
+        {
+            rval = mbi->tag_set_data(cellTag, cells, &cell_field[0]); ERR;
+        }
+        rval = mbi->add_entities(eh, cells); ERR;
+    }
+
+    // entities of each packed mesh, for later fields
+    index.version = bufs.empty() ? -1 : hdrs[0].version;
+    index.verts.assign(bufs.size(), vector<EntityHandle>());
+    index.cells.assign(bufs.size(), vector<EntityHandle>());
+    for (size_t s = 0; s < bufs.size(); s++)
+    {
+        index.verts[s].resize(hdrs[s].nverts);
+        for (long i = 0; i < hdrs[s].nverts; i++)
+            index.verts[s][i] = startv + vert_idx[arrays[s].vert_gids[i]];
+        index.cells[s].resize(hdrs[s].ncells);
+        for (long i = 0; i < hdrs[s].ncells; i++)
+            index.cells[s][i] = startc + cell_idx[arrays[s].cell_gids[i]];
+    }
+
+    // sets and other tags; the part sets become the partition of the consumer mesh, as when it is read from a file,
+    // and without them the mesh set is the partition, as in resolve_and_exchange
+    Range sets;
+    for (size_t s = 0; s < bufs.size(); s++)
+        if (arrays[s].sets)
+            for (EntityHandle set : unpack_sets(mbi, eh, arrays[s].sets, index, s))
+                sets.insert(set);
+    Tag partTag;
+    if (!sets.empty() && mbi->tag_get_handle("PARALLEL_PARTITION", 1, MB_TYPE_INTEGER, partTag) == MB_SUCCESS)
+    {
+        Range parts;
+        rval = mbi->get_entities_by_type_and_tag(eh, MBENTITYSET, &partTag, NULL, 1, parts); ERR;
+        pc->partition_sets() = parts;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &index.version, 1, MPI_INT, MPI_MAX, pc->comm());
+    SetMeshVersion(mbi, eh, index.version);
+
+    if (pc->partition_sets().empty())
+        resolve_and_exchange(mbi, &eh, pc);
+    else
+        resolve_by_gids(mbi, &eh, pc);
+}
+
+// patches the fields of a mesh created by UnpackMesh, in place, from packed fields of the same mesh version
+// returns false if the fields belong to a different version of the mesh topology
+bool UnpackFields(Interface* mbi,                   // moab interface
+        const vector<const char*>& bufs,            // packed meshes, with or without their topology
+        const MeshIndex& index)                     // entities created from each packed mesh
+{
+    ErrorCode rval;
+    Tag vertTag, cellTag;
+
+    for (size_t s = 0; s < bufs.size(); s++)
+    {
+        MeshHeader hdr;
+        memcpy(&hdr, bufs[s], sizeof(MeshHeader));
+        if (hdr.version != index.version || s >= index.verts.size() ||
+                hdr.nverts != (long)index.verts[s].size() || hdr.ncells != (long)index.cells[s].size())
+        {
+            fmt::print(stderr, "UnpackFields: fields of mesh version {}, but the unpacked mesh is version {}\n",
+                    hdr.version, index.version);
+            return false;
+        }
+        MeshArrays arrays(hdr, const_cast<char*>(bufs[s]));
+        if (hdr.vert_field && hdr.nverts)
+        {
+            rval = mbi->tag_get_handle("vertex_field", 1, MB_TYPE_DOUBLE, vertTag); ERR;
+            rval = mbi->tag_set_data(vertTag, &index.verts[s][0], hdr.nverts, arrays.vert_field); ERR;
+        }
+        if (hdr.cell_field && hdr.ncells)
+        {
+            rval = mbi->tag_get_handle("element_field", 1, MB_TYPE_DOUBLE, cellTag); ERR;
+            rval = mbi->tag_set_data(cellTag, &index.cells[s][0], hdr.ncells, arrays.cell_field); ERR;
+        }
+    }
+    return true;
+}
+
+// one array of a packed mesh: its words, and the dataset it belongs to (see MeshCompress)
+struct PackedArray
+{
+    char*       ptr;                                // first word
+    size_t      n;                                  // number of 8-byte words
+    int         dataset;                            // MeshCompress::GIDS, CONN, COORDS, or FIELDS
+};
+
+// the arrays of a packed mesh, in their order in the buffer
+static vector<PackedArray> packed_arrays(const MeshHeader& hdr, char* buf)
+{
+    MeshArrays a(hdr, buf);
+    vector<PackedArray> arrays;
+    if (hdr.topology)
+    {
+        arrays.push_back({ (char*)a.vert_gids,  (size_t)hdr.nverts,                         MeshCompress::GIDS });
+        arrays.push_back({ (char*)a.coords,     (size_t)hdr.nverts * 3,                     MeshCompress::COORDS });
+        arrays.push_back({ (char*)a.cell_gids,  (size_t)hdr.ncells,                         MeshCompress::GIDS });
+        arrays.push_back({ (char*)a.conn,       (size_t)(hdr.ncells * hdr.verts_per_cell),  MeshCompress::CONN });
+    }
+    if (a.vert_field)
+        arrays.push_back({ (char*)a.vert_field, (size_t)hdr.nverts,                         MeshCompress::FIELDS });
+    if (a.cell_field)
+        arrays.push_back({ (char*)a.cell_field, (size_t)hdr.ncells,                         MeshCompress::FIELDS });
+    return arrays;
+}
+
+// encodings of the arrays of a compressed message
+enum { CODEC_RAW, CODEC_VARINT, CODEC_ZLIB, CODEC_QUANT };
+
+// a message that cannot be compressed or restored would leave the consumer with a wrong mesh, so the run stops
+static void codec_error(const char* what)
+{
+    fmt::print(stderr, "mesh transfer compression: {}\n", what);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+// appends the differences of consecutive integers, zigzag mapped to unsigned and written 7 bits per byte, to out
+// global ids and connectivity of neighboring entities are close, so most differences take one or two bytes
+static void encode_ints(const long* v, size_t n, vector<char>& out)
+{
+    long prev = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        long d = v[i] - prev;
+        prev = v[i];
+        unsigned long z = ((unsigned long)d << 1) ^ (unsigned long)(d >> 63);
+        while (z >= 0x80)
+        {
+            out.push_back((char)(z | 0x80));
+            z >>= 7;
+        }
+        out.push_back((char)z);
+    }
+}
+
+// decodes n integers written by encode_ints
+// returns the end of the encoding
+static const char* decode_ints(const char* p, long* v, size_t n)
+{
+    long prev = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned long z = 0;
+        int shift = 0;
+        unsigned char c;
+        do
+        {
+            c = *p++;
+            z |= (unsigned long)(c & 0x7f) << shift;
+            shift += 7;
+        } while (c & 0x80);
+        prev += (long)(z >> 1) ^ -(long)(z & 1);
+        v[i] = prev;
+    }
+    return p;
+}
+
+// appends n doubles, byte shuffled and deflated by zlib, to out
+// shuffling groups byte b of all the values, so that the slowly varying sign, exponent, and high mantissa bytes form
+// long runs that deflate well
+static void encode_doubles(const double* v, size_t n, vector<char>& out)
+{
+    vector<unsigned char> shuffled(n * 8);
+    const unsigned char* bytes = (const unsigned char*)v;
+    for (size_t i = 0; i < n; i++)
+        for (int b = 0; b < 8; b++)
+            shuffled[b * n + i] = bytes[8 * i + b];
+
+    size_t pos = out.size();
+    uLongf size = compressBound(n * 8);
+    out.resize(pos + size);
+    if (compress2((Bytef*)&out[pos], &size, &shuffled[0], n * 8, Z_BEST_SPEED) != Z_OK)
+        codec_error("zlib compression failed");
+    out.resize(pos + size);
+}
+
+// decodes n doubles written by encode_doubles from size bytes
+static void decode_doubles(const char* p, size_t size, double* v, size_t n)
+{
+    vector<unsigned char> shuffled(n * 8);
+    uLongf len = n * 8;
+    if (uncompress(&shuffled[0], &len, (const Bytef*)p, size) != Z_OK || len != n * 8)
+        codec_error("zlib decompression failed");
+    unsigned char* bytes = (unsigned char*)v;
+    for (size_t i = 0; i < n; i++)
+        for (int b = 0; b < 8; b++)
+            bytes[8 * i + b] = shuffled[b * n + i];
+}
+
+// rounds n doubles to multiples of step, into q
+// returns false if a value is not finite or its multiple is outside +-2^62, where the differences taken by
+// encode_ints would overflow; such fields are sent losslessly instead
+static bool quantize(const double* v, size_t n, double step, vector<long>& q)
+{
+    const double limit = 4611686018427387904.0;        // 2^62
+    q.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        double r = v[i] / step;
+        if (!(fabs(r) < limit))                         // also false for NaN
+            return false;
+        q[i] = llround(r);
+    }
+    return true;
+}
+
+// compresses the datasets of a packed mesh selected by compress into a message
+// the message is the header of the packed mesh (compressed = 1), followed by each array as a codec byte, the size of
+// its encoding in bytes, and its encoding; an array not selected, or not smaller encoded, is copied raw, and so are
+// the sets and tags
+static void CompressMesh(const char* buf,           // packed mesh
+        const MeshCompress& compress,               // datasets to compress
+        vector<char>& out)                          // (output) compressed message
+{
+    MeshHeader hdr;
+    memcpy(&hdr, buf, sizeof(MeshHeader));
+    hdr.compressed = 1;
+    out.resize(sizeof(MeshHeader));
+    memcpy(&out[0], &hdr, sizeof(MeshHeader));
+
+    const double step = 2 * compress.tol;
+    vector<long> q;
+    for (const PackedArray& a : packed_arrays(hdr, const_cast<char*>(buf)))
+    {
+        int codec = CODEC_RAW;
+        if (a.n && (compress.datasets & a.dataset))
+        {
+            if (a.dataset == MeshCompress::GIDS || a.dataset == MeshCompress::CONN)
+                codec = CODEC_VARINT;
+            else if (a.dataset == MeshCompress::FIELDS && compress.tol > 0 &&
+                    quantize((const double*)a.ptr, a.n, step, q))
+                codec = CODEC_QUANT;
+            else
+                codec = CODEC_ZLIB;
+        }
+
+        size_t pos = out.size();
+        out.resize(pos + 1 + sizeof(uint64_t));
+        if (codec == CODEC_VARINT)
+            encode_ints((const long*)a.ptr, a.n, out);
+        else if (codec == CODEC_ZLIB)
+            encode_doubles((const double*)a.ptr, a.n, out);
+        else if (codec == CODEC_QUANT)
+        {
+            out.resize(out.size() + sizeof(double));
+            memcpy(&out[pos + 1 + sizeof(uint64_t)], &step, sizeof(double));
+            encode_ints(&q[0], a.n, out);
+        }
+
+        uint64_t size = out.size() - pos - 1 - sizeof(uint64_t);
+        if (codec == CODEC_RAW || size >= a.n * 8)
+        {
+            codec = CODEC_RAW;
+            size  = a.n * 8;
+            out.resize(pos + 1 + sizeof(uint64_t));
+            out.insert(out.end(), a.ptr, a.ptr + size);
+        }
+        out[pos] = (char)codec;
+        memcpy(&out[pos + 1], &size, sizeof(uint64_t));
+    }
+    if (hdr.sets)
+        out.insert(out.end(), buf + hdr.bytes() - hdr.sets, buf + hdr.bytes());
+}
+
+// restores the packed mesh of a message written by CompressMesh
+static void DecompressMesh(const char* msg,         // compressed message
+        vector<char>& buf)                          // (output) packed mesh
+{
+    MeshHeader hdr;
+    memcpy(&hdr, msg, sizeof(MeshHeader));
+    hdr.compressed = 0;
+    buf.resize(hdr.bytes());
+    memcpy(&buf[0], &hdr, sizeof(MeshHeader));
+
+    const char* p = msg + sizeof(MeshHeader);
+    for (const PackedArray& a : packed_arrays(hdr, &buf[0]))
+    {
+        int codec = *p;
+        uint64_t size;
+        memcpy(&size, p + 1, sizeof(uint64_t));
+        p += 1 + sizeof(uint64_t);
+
+        if (codec == CODEC_VARINT)
+        {
+            if (decode_ints(p, (long*)a.ptr, a.n) != p + size)
+                codec_error("corrupt integer encoding");
+        }
+        else if (codec == CODEC_ZLIB)
+            decode_doubles(p, size, (double*)a.ptr, a.n);
+        else if (codec == CODEC_QUANT)
+        {
+            double step;
+            memcpy(&step, p, sizeof(double));
+            vector<long> q(a.n);
+            if (decode_ints(p + sizeof(double), &q[0], a.n) != p + size)
+                codec_error("corrupt integer encoding");
+            double* v = (double*)a.ptr;
+            for (size_t i = 0; i < a.n; i++)
+                v[i] = q[i] * step;
+        }
+        else if (codec == CODEC_RAW && size == a.n * 8)
+            memcpy(a.ptr, p, a.n * 8);
+        else
+            codec_error("unknown array encoding");
+        p += size;
+    }
+    if (hdr.sets)
+        memcpy(&buf[hdr.bytes() - hdr.sets], p, hdr.sets);
+}
+
+// centroid of the vertices of a mesh set, and its number of cells
+static void mesh_centroid(Interface* mbi,
+        EntityHandle eh,
+        double* centroid,
+        double& cells)
+{
+    ErrorCode rval;
+    Range verts;
+    int ncells;
+    rval = mbi->get_entities_by_type(eh, MBVERTEX, verts); ERR;
+    rval = mbi->get_number_entities_by_dimension(eh, 3, ncells); ERR;
+    cells = ncells;
+
+    centroid[0] = centroid[1] = centroid[2] = 0.0;
+    vector<double> coords(3 * verts.size());
+    if (!verts.empty())
+    {
+        rval = mbi->get_coords(verts, &coords[0]); ERR;
+    }
+    for (size_t i = 0; i < verts.size(); i++)
+        for (int d = 0; d < 3; d++)
+            centroid[d] += coords[3 * i + d] / verts.size();
+}
+
+// recursive coordinate bisection of weighted points into parts [first_part, first_part + nparts)
+// splits the points at the weighted median along the axis of largest extent, in proportion to the number of parts on
+// each side, and recurses
+static void rcb(vector<int>& points,                // indices of the points to split (reordered)
+        size_t begin,                               // first point
+        size_t end,                                 // last point + 1
+        const vector<double>& centroids,            // x, y, z, weight of every point
+        int first_part,                             // first part
+        int nparts,                                 // number of parts
+        vector<int>& parts)                         // (output) part of each point
+{
+    if (nparts == 1)
+    {
+        for (size_t i = begin; i < end; i++)
+            parts[points[i]] = first_part;
+        return;
+    }
+
+    // axis of largest extent
+    int axis = 0;
+    double extent = -1.0;
+    for (int d = 0; d < 3; d++)
+    {
+        double lo = std::numeric_limits<double>::max(), hi = -lo;
+        for (size_t i = begin; i < end; i++)
+        {
+            lo = min(lo, centroids[4 * points[i] + d]);
+            hi = max(hi, centroids[4 * points[i] + d]);
+        }
+        if (hi - lo > extent)
+        {
+            extent  = hi - lo;
+            axis    = d;
+        }
+    }
+    sort(points.begin() + begin, points.begin() + end, [&](int a, int b)
+            { return centroids[4 * a + axis] < centroids[4 * b + axis]; });
+
+    // weighted split, in proportion to the parts on the left
+    int left = nparts / 2;
+    double total = 0.0;
+    for (size_t i = begin; i < end; i++)
+        total += centroids[4 * points[i] + 3];
+    double target = total * left / nparts, sum = 0.0;
+    size_t split = begin;
+    while (split < end && sum + centroids[4 * points[split] + 3] / 2 <= target)
+        sum += centroids[4 * points[split++] + 3];
+
+    rcb(points, begin, split, centroids, first_part, left, parts);
+    rcb(points, split, end, centroids, first_part + left, nparts - left, parts);
+}
+
+// prints min, mean, and max cells per consumer rank of an assignment of producer ranks to consumer ranks
+static void print_balance(const char* name,
+        const vector<int>& dest,
+        const vector<double>& centroids,
+        int ncons)
+{
+    vector<double> load(ncons, 0.0);
+    for (size_t p = 0; p < dest.size(); p++)
+        load[dest[p]] += centroids[4 * p + 3];
+    double lo = *min_element(load.begin(), load.end());
+    double hi = *max_element(load.begin(), load.end());
+    double mean = 0.0;
+    for (double l : load)
+        mean += l / ncons;
+    fmt::print(stderr, "mesh transfer {} assignment: cells per consumer rank min {} mean {:.1f} max {} imbalance {:.3f}\n",
+            name, lo, mean, hi, mean > 0 ? hi / mean : 0.0);
+}
+
+// drops the entities, sets, and tags of a loaded mesh that the consumer did not select: the entities of dimension higher
+// than select.dim, the sets contained in the mesh set without any of the tags in select.sets (the part sets are always
+// kept), and the tags not in select.tags, except moab's internal tags, the mesh version, and PARALLEL_PARTITION
+// keep_gids: keep the global ids even if not selected, to patch the fields of later time steps or pack snapshots
+void SelectMesh(Interface* mbi,                     // moab interface
+        EntityHandle eh,                            // mesh set
+        const MeshSelect& select,                   // entities, sets, and tags to keep
+        bool keep_gids)                             // keep the global ids
+{
+    ErrorCode rval;
+
+    Range sets;
+    rval = mbi->get_entities_by_type(0, MBENTITYSET, sets); ERR;
+    for (int d = 3; d > select.dim; d--)
+    {
+        Range ents;
+        rval = mbi->get_entities_by_dimension(0, d, ents); ERR;
+        if (ents.empty())
+            continue;
+        for (Range::iterator it = sets.begin(); it != sets.end(); ++it)
+        {
+            rval = mbi->remove_entities(*it, ents); ERR;
+        }
+        rval = mbi->delete_entities(ents); ERR;
+    }
+
+    if (!select.sets.empty())
+    {
+        Range dropped;
+        rval = mbi->get_entities_by_type(eh, MBENTITYSET, dropped); ERR;
+        dropped = subtract(dropped, selected_sets(mbi, eh, select));
+        if (!dropped.empty())
+        {
+            for (Range::iterator it = sets.begin(); it != sets.end(); ++it)
+            {
+                rval = mbi->remove_entities(*it, dropped); ERR;
+            }
+            rval = mbi->delete_entities(dropped); ERR;
+        }
+    }
+
+    if (select.tags.empty())
+        return;
+    vector<Tag> tags;
+    rval = mbi->tag_get_tags(tags); ERR;
+    for (Tag tag : tags)
+    {
+        string name;
+        rval = mbi->tag_get_name(tag, name); ERR;
+        if (name.compare(0, 2, "__") == 0 || name == "MESH_VERSION" || name == "PARALLEL_PARTITION" ||
+                select.tag(name) || (keep_gids && name == "HANDLEID"))
+            continue;
+        rval = mbi->tag_delete(tag); ERR;
+    }
+}
+
+// bytes of the datasets of a mesh loaded from a file: the coordinates of the vertices, the connectivity of the cells,
+// and the values of the fixed-size tags on them, except moab's internal tags
+size_t MeshDataBytes(Interface* mbi)                // moab interface
+{
+    ErrorCode rval;
+    size_t bytes = 0;
+
+    Range verts;
+    rval = mbi->get_entities_by_dimension(0, 0, verts); ERR;
+    bytes += 3 * sizeof(double) * verts.size();
+    for (int type = MBEDGE; type < MBENTITYSET; type++)
+    {
+        Range ents;
+        rval = mbi->get_entities_by_type(0, (EntityType)type, ents); ERR;
+        if (ents.empty())
+            continue;
+        const EntityHandle* conn;
+        int num_conn;
+        vector<EntityHandle> storage;
+        rval = mbi->get_connectivity(ents.front(), conn, num_conn, false, &storage); ERR;
+        bytes += sizeof(EntityHandle) * num_conn * ents.size();
+    }
+
+    vector<Tag> tags;
+    rval = mbi->tag_get_tags(tags); ERR;
+    for (Tag tag : tags)
+    {
+        string name;
+        int tag_bytes;
+        rval = mbi->tag_get_name(tag, name); ERR;
+        if (name.compare(0, 2, "__") == 0 || mbi->tag_get_bytes(tag, tag_bytes) != MB_SUCCESS)
+            continue;
+        Range tagged;
+        rval = mbi->get_entities_by_type_and_tag(0, MBMAXTYPE, &tag, 0, 1, tagged); ERR;
+        bytes += (size_t)tag_bytes * tagged.size();
+    }
+    return bytes;
+}
+
+// sets up the transport: assigns the producer ranks to the consumer ranks, and finds the peers of this rank and which
+// of them are on the same node
+// repart = rank: contiguous ranges of producer ranks; rcb: recursive coordinate bisection of the centroids of the
+// producer meshes, weighted by their cells, for compact and balanced consumer subdomains
+// native: no peer is treated as being on the same node
+// collective over both tasks
+MeshXfer::MeshXfer(MPI_Comm intercomm_,             // producer-consumer intercomm
+        bool producer_,                             // this rank is a producer
+        bool native_,                               // native transfer (messages only, with the sets and tags)
+        const std::string& repart,                  // assignment of producer ranks to consumer ranks
+        const MeshCompress& compress_,              // datasets compressed in the messages between nodes
+        Interface* mbi,                             // producer: moab interface
+        EntityHandle eh):                           // producer: mesh set
+    producer(producer_), native(native_), compress(compress_)
+{
+    MPI_Comm_dup(intercomm_, &intercomm);
+
+    int rank, nlocal, nremote;
+    MPI_Comm_rank(intercomm, &rank);
+    MPI_Comm_size(intercomm, &nlocal);
+    MPI_Comm_remote_size(intercomm, &nremote);
+    int nprod = producer ? nlocal : nremote;
+    int ncons = producer ? nremote : nlocal;
+
+    // the merged communicator has the producer ranks first, in order
+    MPI_Intercomm_merge(intercomm, producer ? 0 : 1, &all);
+    int merged_rank, merged_size;
+    MPI_Comm_rank(all, &merged_rank);
+    MPI_Comm_size(all, &merged_size);
+
+    // centroid and cells of the mesh of each producer rank
+    double mine[4] = { 0.0, 0.0, 0.0, 0.0 };
+    if (producer && mbi)
+        mesh_centroid(mbi, eh, mine, mine[3]);
+    vector<double> centroids(4 * merged_size);
+    MPI_Allgather(mine, 4, MPI_DOUBLE, &centroids[0], 4, MPI_DOUBLE, all);
+
+    // consumer rank of each producer rank
+    vector<int> dest(nprod);
+    for (int p = 0; p < nprod; p++)
+        dest[p] = (long)p * ncons / nprod;
+    if (merged_rank == 0)
+        print_balance("rank", dest, centroids, ncons);
+    if (repart == "rcb")
+    {
+        vector<int> points(nprod);
+        for (int p = 0; p < nprod; p++)
+            points[p] = p;
+        rcb(points, 0, nprod, centroids, 0, ncons, dest);
+        if (merged_rank == 0)
+            print_balance("rcb", dest, centroids, ncons);
+    }
+
+    if (producer)
+        peers.push_back(dest[rank]);
+    else
+        for (int p = 0; p < nprod; p++)
+            if (dest[p] == rank)
+                peers.push_back(p);
+
+    // ranks of both tasks on this node, and their task and rank in the task
+    MPI_Comm_split_type(all, MPI_COMM_TYPE_SHARED, merged_rank, MPI_INFO_NULL, &node);
+    int node_size;
+    MPI_Comm_size(node, &node_size);
+    int me[2] = { producer ? 1 : 0, rank };
+    vector<int> node_ranks(2 * node_size);
+    MPI_Allgather(me, 2, MPI_INT, &node_ranks[0], 2, MPI_INT, node);
+
+    for (int peer : peers)
+    {
+        int node_rank = -1;
+        for (int r = 0; r < node_size; r++)
+            if (!native && node_ranks[2 * r] == (producer ? 0 : 1) && node_ranks[2 * r + 1] == peer)
+                node_rank = r;
+        peer_node_ranks.push_back(node_rank);
+    }
+
+    // summary: producer ranks sending through shared memory and through messages
+    int counts[2] = { 0, 0 };
+    if (producer)
+        counts[peer_node_ranks[0] >= 0 ? 0 : 1] = 1;
+    MPI_Allreduce(MPI_IN_PLACE, counts, 2, MPI_INT, MPI_SUM, all);
+    if (merged_rank == 0)
+        fmt::print(stderr, "mesh transfer: {} producer ranks to {} consumer ranks, {} in shared memory, {} in messages\n",
+                nprod, ncons, counts[0], counts[1]);
+
+    recv_bufs.resize(peers.size());
+    raw_bufs.resize(peers.size());
+}
+
+MeshXfer::~MeshXfer()
+{
+    free_plan();
+    if (win != MPI_WIN_NULL)
+    {
+        MPI_Win_unlock_all(win);
+        MPI_Win_free(&win);
+    }
+    MPI_Comm_free(&node);
+    MPI_Comm_free(&all);
+    MPI_Comm_free(&intercomm);
+}
+
+// waits for all the ranks of the node to be done with the published step
+void MeshXfer::release(PhaseTimers* timers)
+{
+    if (!pending)
+        return;
+    PhaseTimer wait(timers, PHASE_WAIT);
+    MPI_Barrier(node);
+    pending = false;
+}
+
+// releases the persistent requests of the plan for fields-only steps
+void MeshXfer::free_plan()
+{
+    if (fields_send_req != MPI_REQUEST_NULL)
+    {
+        MPI_Wait(&fields_send_req, MPI_STATUS_IGNORE);
+        MPI_Request_free(&fields_send_req);
+    }
+    for (auto& req : fields_recv_reqs)
+        if (req != MPI_REQUEST_NULL)
+            MPI_Request_free(&req);
+    fields_recv_reqs.clear();
+    plan_version = -1;
+}
+
+// makes the packed meshes of this node visible to the other ranks of the node, after growing the window if any rank
+// needs more room than it has (need = bytes of this rank's part of the window, written by the caller after this
+// returns, and published by the barrier that follows)
+// fields-only steps fit in the room of the topology step before them, and skip the check
+void MeshXfer::publish(MPI_Aint need,               // bytes needed by this rank in the window
+        bool topology,                              // the step carries the topology
+        PhaseTimers* timers)                        // phase timers
+{
+    if (!topology)
+    {
+        assert(need <= capacity);
+        return;
+    }
+    int grow = need > capacity;
+    MPI_Allreduce(MPI_IN_PLACE, &grow, 1, MPI_INT, MPI_MAX, node);
+    if (grow)
+    {
+        if (win != MPI_WIN_NULL)
+        {
+            MPI_Win_unlock_all(win);
+            MPI_Win_free(&win);
+        }
+        MPI_Win_allocate_shared(need, 1, MPI_INFO_NULL, node, &base, &win);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+        capacity = need;
+    }
+}
+
+// packs the mesh of this rank for step k; in the window for a consumer on this node, or in a message otherwise,
+// compressed if any dataset is selected for compression
+void MeshXfer::send(Interface* mbi,                 // moab interface
+        EntityHandle eh,                            // mesh set
+        int version,                                // mesh version
+        bool topology,                              // send the vertices and cells, not only the fields
+        const MeshSelect& select,                   // cells and fields needed by the consumer
+        int k,                                      // step
+        PhaseTimers* timers)                        // phase timers
+{
+    release(timers);
+
+    bool local = peer_node_ranks[0] >= 0;
+    const vector<char>* sets = NULL;
+    if (native && topology)
+    {
+        PhaseTimer write(timers, PHASE_WRITE);
+        PackSets(mbi, eh, select, sets_buf);
+        sets = &sets_buf;
+    }
+    size_t bytes = PackMesh(mbi, eh, version, topology, select, NULL, sets);
+
+    publish(local ? bytes : 0, topology, timers);
+    if (local)
+    {
+        PhaseTimer write(timers, PHASE_WRITE);
+        PackMesh(mbi, eh, version, topology, select, base);
+        MPI_Win_sync(win);
+    }
+    else if (!topology && plan_fields())
+    {
+        // fields only: replay the persistent send of the plan, built on the first fields-only step of this version
+        {
+            PhaseTimer wait(timers, PHASE_WAIT);
+            MPI_Wait(&send_req, MPI_STATUS_IGNORE);
+            MPI_Wait(&fields_send_req, MPI_STATUS_IGNORE);
+        }
+        PhaseTimer write(timers, PHASE_WRITE);
+        if (plan_version != version)
+        {
+            free_plan();
+            fields_buf.resize(bytes);
+            MPI_Send_init(&fields_buf[0], bytes, MPI_BYTE, peers[0], fields_tag, intercomm, &fields_send_req);
+            plan_version = version;
+        }
+        PackMesh(mbi, eh, version, topology, select, &fields_buf[0]);
+        MPI_Start(&fields_send_req);
+    }
+    else
+    {
+        free_plan();
+        {
+            PhaseTimer wait(timers, PHASE_WAIT);
+            MPI_Wait(&send_req, MPI_STATUS_IGNORE);
+        }
+        PhaseTimer write(timers, PHASE_WRITE);
+        send_buf.resize(bytes);
+        PackMesh(mbi, eh, version, topology, select, &send_buf[0], sets);
+        write.stop();
+        if (compress.datasets)
+        {
+            PhaseTimer zip(timers, PHASE_COMPRESS);
+            double t0 = MPI_Wtime();
+            CompressMesh(&send_buf[0], compress, zip_buf);
+            send_buf.swap(zip_buf);
+            zip_time    += MPI_Wtime() - t0;
+            raw_bytes   += bytes;
+            zip_bytes   += send_buf.size();
+        }
+        MPI_Isend(&send_buf[0], send_buf.size(), MPI_BYTE, peers[0], k, intercomm, &send_req);
+    }
+
+    PhaseTimer wait(timers, PHASE_WAIT);
+    MPI_Barrier(node);
+    pending = true;
+}
+
+// waits for step k from the producer ranks of this consumer rank, mapping the meshes packed on this node in place
+// the fields-only steps after a topology step replay persistent receives of known sizes, without probing, unless the
+// fields are compressed
+const vector<const char*>& MeshXfer::receive(int k,                 // step
+        bool topology,                                              // the step carries the topology
+        PhaseTimers* timers,                                        // phase timers
+        size_t& bytes)                                              // (output) bytes sent: packed meshes on this
+                                                                    // node, messages between nodes
+{
+    release(timers);
+    publish(0, topology, timers);
+
+    PhaseTimer wait(timers, PHASE_WAIT);
+    MPI_Barrier(node);
+    pending = true;
+    if (win != MPI_WIN_NULL)
+        MPI_Win_sync(win);
+
+    bufs.resize(peers.size());
+    bytes = 0;
+
+    // fields only: the plan is built from the sizes of the topology step
+    bool plan = !topology && plan_fields();
+    if (plan)
+    {
+        if (plan_version < 0)
+        {
+            for (size_t i = 0; i < peers.size(); i++)
+                if (peer_node_ranks[i] < 0)
+                {
+                    recv_bufs[i].resize(peer_fields_bytes[i]);
+                    fields_recv_reqs.push_back(MPI_REQUEST_NULL);
+                    MPI_Recv_init(&recv_bufs[i][0], peer_fields_bytes[i], MPI_BYTE, peers[i], fields_tag, intercomm,
+                            &fields_recv_reqs.back());
+                }
+            plan_version = recv_version;
+        }
+        if (!fields_recv_reqs.empty())
+        {
+            MPI_Startall(fields_recv_reqs.size(), fields_recv_reqs.data());
+            MPI_Waitall(fields_recv_reqs.size(), fields_recv_reqs.data(), MPI_STATUSES_IGNORE);
+        }
+    }
+    else
+        free_plan();
+
+    peer_fields_bytes.resize(peers.size());
+    for (size_t i = 0; i < peers.size(); i++)
+    {
+        if (plan && peer_node_ranks[i] < 0)
+            bufs[i] = &recv_bufs[i][0];
+        else if (peer_node_ranks[i] >= 0)
+        {
+            MPI_Aint size;
+            int disp;
+            char* ptr;
+            MPI_Win_shared_query(win, peer_node_ranks[i], &size, &disp, &ptr);
+            bufs[i] = ptr;
+        }
+        else
+        {
+            MPI_Status status;
+            int count;
+            MPI_Probe(peers[i], k, intercomm, &status);
+            MPI_Get_count(&status, MPI_BYTE, &count);
+            recv_bufs[i].resize(count);
+            MPI_Recv(&recv_bufs[i][0], count, MPI_BYTE, peers[i], k, intercomm, MPI_STATUS_IGNORE);
+            bufs[i] = &recv_bufs[i][0];
+        }
+        // bytes sent: the packed mesh in shared memory, the message (compressed or not) between nodes
+        MeshHeader hdr;
+        memcpy(&hdr, bufs[i], sizeof(MeshHeader));
+        bytes += peer_node_ranks[i] >= 0 ? hdr.bytes() : recv_bufs[i].size();
+        if (topology)
+        {
+            recv_version = hdr.version;
+            hdr.topology = 0;
+            hdr.sets     = 0;
+            peer_fields_bytes[i] = hdr.bytes();
+        }
+    }
+    wait.stop();
+
+    // compressed messages
+    for (size_t i = 0; i < peers.size(); i++)
+    {
+        MeshHeader hdr;
+        memcpy(&hdr, bufs[i], sizeof(MeshHeader));
+        if (!hdr.compressed)
+            continue;
+        PhaseTimer unzip(timers, PHASE_DECOMPRESS);
+        double t0 = MPI_Wtime();
+        DecompressMesh(bufs[i], raw_bufs[i]);
+        bufs[i] = &raw_bufs[i][0];
+        zip_time    += MPI_Wtime() - t0;
+        raw_bytes   += raw_bufs[i].size();
+    }
+    return bufs;
+}
+
+// ends the trial: the last step is released, and the last message sent
+// with compression, prints the compression ratio of the messages and the compression and decompression throughput
+// (bytes of packed meshes per second of one rank)
+void MeshXfer::finish(PhaseTimers* timers)
+{
+    release(timers);
+    {
+        PhaseTimer wait(timers, PHASE_WAIT);
+        MPI_Wait(&send_req, MPI_STATUS_IGNORE);
+        MPI_Wait(&fields_send_req, MPI_STATUS_IGNORE);
+    }
+
+    if (!compress.datasets)
+        return;
+    // producer raw bytes, compressed bytes, and time; consumer raw bytes and time
+    double totals[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+    if (producer)
+    {
+        totals[0] = raw_bytes;
+        totals[1] = zip_bytes;
+        totals[2] = zip_time;
+    }
+    else
+    {
+        totals[3] = raw_bytes;
+        totals[4] = zip_time;
+    }
+    int rank;
+    MPI_Comm_rank(all, &rank);
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : totals, totals, 5, MPI_DOUBLE, MPI_SUM, 0, all);
+    if (rank == 0)
+        fmt::print(stderr, "mesh transfer compression: {:.3f} MB packed, {:.3f} MB sent, ratio {:.2f}, "
+                "compress {:.1f} MB/s, decompress {:.1f} MB/s\n", totals[0] / 1048576.0, totals[1] / 1048576.0,
+                totals[1] > 0 ? totals[0] / totals[1] : 0.0, totals[2] > 0 ? totals[0] / 1048576.0 / totals[2] : 0.0,
+                totals[4] > 0 ? totals[3] / 1048576.0 / totals[4] : 0.0);
+    raw_bytes = zip_bytes = zip_time = 0;
+}
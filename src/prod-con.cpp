@@ -4,9 +4,148 @@
 #include    "opts.h"
 
 #include    <dlfcn.h>
+#include    <fstream>
+#include    <sstream>
+#include    <sched.h>
+#include    <pthread.h>
 
 #include    "prod-con.hpp"
 
+// task interface exported by producer.so and consumer.so: init builds the task state once, run performs one trial
+// with it, and finalize releases it
+typedef void* (*task_init_t)(communicator&, const std::vector<communicator>&, bool, int, int, const TaskParams&);
+typedef void  (*task_run_t)(void*, const TaskParams&);
+typedef void  (*task_finalize_t)(void*);
+
+// splits the cores this rank may run on into a producer set and a disjoint consumer set, in proportion prod_frac
+// returns false if there are fewer than two cores to split
+static bool split_cores(float       prod_frac,              // fraction of the cores for the producer
+        cpu_set_t&                  prod_cores,             // (output) producer cores
+        cpu_set_t&                  con_cores)              // (output) consumer cores
+{
+    cpu_set_t all;
+    if (sched_getaffinity(0, sizeof(all), &all))
+        return false;
+    std::vector<int> cores;
+    for (int c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET(c, &all))
+            cores.push_back(c);
+    if (cores.size() < 2)
+        return false;
+
+    int nprod = std::max(1, std::min((int)cores.size() - 1, (int)(cores.size() * prod_frac + 0.5)));
+    CPU_ZERO(&prod_cores);
+    CPU_ZERO(&con_cores);
+    for (int i = 0; i < (int)cores.size(); i++)
+        CPU_SET(cores[i], i < nprod ? &prod_cores : &con_cores);
+    return true;
+}
+
+// places the world ranks in the producer or the consumer (space partitioning), returning 1 if this rank is a
+// producer, 0 if it is a consumer, or -1 (on all ranks) if the placement is invalid, and the key ordering the ranks
+// of each task
+// block: the first prod_frac of the world ranks are producers, ordered by world rank
+// interleaved: prod_frac of the ranks of each node are producers, spread evenly among them, and the ranks of each
+// task are ordered by node, so that the i-th producers and consumers of the tasks are on the same node; nodes with
+// different numbers of ranks would get different producer to consumer ratios, so then the placement is block instead
+// otherwise, placement is a map file with one line "<world rank> <p|c>" per rank (# starts a comment), which must
+// assign every world rank exactly once
+static int place_ranks(diy::mpi::communicator&                  world,              // world communicator
+        const std::string&                      placement,          // block, interleaved, or map file name
+        float                                   prod_frac,          // fraction of the ranks in the producer
+        int&                                    key)                // (output) order of this rank in its task
+{
+    key = world.rank();
+    if (placement == "block")
+        return world.rank() < (int)(world.size() * prod_frac);
+
+    if (placement == "interleaved")
+    {
+        MPI_Comm node;
+        MPI_Comm_split_type(world, MPI_COMM_TYPE_SHARED, world.rank(), MPI_INFO_NULL, &node);
+        int node_rank, node_size;
+        MPI_Comm_rank(node, &node_rank);
+        MPI_Comm_size(node, &node_size);
+
+        int min_size, max_size;
+        MPI_Allreduce(&node_size, &min_size, 1, MPI_INT, MPI_MIN, world);
+        MPI_Allreduce(&node_size, &max_size, 1, MPI_INT, MPI_MAX, world);
+        if (min_size != max_size)
+        {
+            if (world.rank() == 0)
+                fmt::print(stderr, "Warning: nodes have {} to {} ranks, so interleaved placement would give them "
+                        "different producer to consumer ratios; using block placement instead\n", min_size, max_size);
+            MPI_Comm_free(&node);
+            return world.rank() < (int)(world.size() * prod_frac);
+        }
+
+        // index of the node, from the ranks of the node leaders
+        MPI_Comm leaders;
+        MPI_Comm_split(world, node_rank == 0 ? 0 : MPI_UNDEFINED, world.rank(), &leaders);
+        int node_id = 0;
+        if (leaders != MPI_COMM_NULL)
+        {
+            MPI_Comm_rank(leaders, &node_id);
+            MPI_Comm_free(&leaders);
+        }
+        MPI_Bcast(&node_id, 1, MPI_INT, 0, node);
+        MPI_Comm_free(&node);
+
+        key = node_id * world.size() + node_rank;
+        return (int)((node_rank + 1) * prod_frac) > (int)(node_rank * prod_frac);
+    }
+
+    // map file, read and checked by rank 0; -1 marks a rank not assigned yet, and then a rejected map
+    std::vector<int> is_producer(world.size(), -1);
+    if (world.rank() == 0)
+    {
+        bool valid = true;
+        std::ifstream in(placement);
+        if (!in)
+        {
+            fmt::print(stderr, "Couldn't open placement map file {}\n", placement);
+            valid = false;
+        }
+        std::string line;
+        for (int line_num = 1; std::getline(in, line); line_num++)
+        {
+            line = line.substr(0, line.find('#'));
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+            int rank;
+            char task;
+            if (sscanf(line.c_str(), "%d %c", &rank, &task) != 2 ||
+                    (task != 'p' && task != 'P' && task != 'c' && task != 'C'))
+            {
+                fmt::print(stderr, "{}:{}: expected \"<world rank> <p|c>\"\n", placement, line_num);
+                valid = false;
+            }
+            else if (rank < 0 || rank >= world.size())
+            {
+                fmt::print(stderr, "{}:{}: rank {} is not in 0..{}\n", placement, line_num, rank, world.size() - 1);
+                valid = false;
+            }
+            else if (is_producer[rank] >= 0)
+            {
+                fmt::print(stderr, "{}:{}: rank {} is assigned more than once\n", placement, line_num, rank);
+                valid = false;
+            }
+            else
+                is_producer[rank] = (task == 'p' || task == 'P');
+        }
+        for (int rank = 0; rank < world.size(); rank++)
+            if (is_producer[rank] < 0)
+            {
+                fmt::print(stderr, "{}: rank {} is not assigned\n", placement, rank);
+                valid = false;
+            }
+        if (!valid)
+            std::fill(is_producer.begin(), is_producer.end(), -1);
+    }
+    MPI_Bcast(&is_producer[0], world.size(), MPI_INT, 0, world);
+    return is_producer[world.rank()];
+}
+
 int main(int argc, char* argv[])
 {
     diy::mpi::environment     env(argc, argv, MPI_THREAD_MULTIPLE);
@@ -14,13 +153,37 @@ int main(int argc, char* argv[])
 
     int                       mem_blocks        = -1;             // all blocks in memory
     int                       threads           = 1;              // no multithreading
+    int                       mesh_type         = 0;              // producer mesh type (hex)
+    int                       mesh_size         = 10;             // producer mesh size (vertices) per side
+    int                       mesh_slab         = 0;              // producer blocks are cubes
+    int                       tot_blocks        = -1;             // one producer block per rank
+    int                       resolve           = 0;              // moab resolve_shared_ents
+    int                       stats             = 1;              // print producer mesh statistics
+    int                       ghost             = 0;              // no ghost layers
+    int                       order             = 0;              // i-j-k order of generated vertices and cells
+    int                       steps             = 1;              // one time step
+    int                       delta             = 0;              // every time step carries the whole mesh
+    int                       mem_budget        = 0;              // generate the whole producer mesh at once
     int                       metadata          = 1;              // build in-memory metadata
     int                       passthru          = 0;              // write file to disk
     bool                      shared            = false;          // producer and consumer run on the same ranks
+    bool                      concurrent        = false;          // shared producer and consumer run one after the other
     float                     prod_frac         = 1.0 / 2.0;      // fraction of world ranks in producer
+    std::string               placement         = "block";        // producer ranks first, then consumer ranks
+    std::string               xfer              = "lowfive";      // mesh transfer through lowfive files
+    std::string               repart            = "rank";         // producer rank p to consumer rank p * ncons / nprod
+    int                       select_dim        = 3;              // consumer needs vertices and cells
+    std::string               select_sets;                        // consumer needs all the sets
+    std::string               select_tags;                        // consumer needs all the tags
+    int                       out_every         = 1;              // consumer writes its mesh at every time step
+    int                       out_async         = 0;              // consumer writes its mesh in line
+    std::string               compress;                           // messages between nodes are not compressed
+    double                    compress_tol      = 0.0;            // compressed fields are lossless
     std::string               producer_exec     = "./producer.so";    // name of producer executable
     std::string               consumer_exec     = "./consumer.so";    // name of consumer executable
     int                       ntrials           = 1;              // number of trials to run
+    std::string               timers_file       = "timers";       // prefix of the phase timer output files
+    std::string               csv_file;                           // benchmark results file (empty = none)
     bool                      verbose, help;
 
     // get command line arguments
@@ -29,15 +192,39 @@ int main(int argc, char* argv[])
     ops
         >> Option('t', "thread",    threads,        "number of threads")
         >> Option(     "memblks",   mem_blocks,     "number of blocks to keep in memory")
+        >> Option(     "mesh_type", mesh_type,      "producer mesh type: 0 = hex, 1 = tet, 2 = structured hex")
+        >> Option(     "mesh_size", mesh_size,      "producer mesh size (vertices) per side")
+        >> Option(     "mesh_slab", mesh_slab,      "producer block shape: 0 = cubes, 1 = slabs")
+        >> Option('b', "blocks",    tot_blocks,     "total number of blocks in the producer mesh (default one per rank)")
+        >> Option(     "resolve",   resolve,        "shared entities: 0 = resolve_shared_ents, 1 = from decomposition, 2 = 1 validated against 0")
+        >> Option(     "stats",     stats,          "compute and print producer mesh statistics (0 = off for timed runs)")
+        >> Option('g', "ghost",     ghost,          "number of ghost layers generated around each producer block")
+        >> Option(     "order",     order,          "order of generated vertices and cells: 0 = i-j-k, 1 = Morton, 2 = Hilbert")
+        >> Option(     "steps",     steps,          "number of time steps written by the producer and read by the consumer")
+        >> Option(     "delta",     delta,          "time steps after the first carry only the fields (0 = off, 1 = on)")
+        >> Option(     "mem_budget", mem_budget,    "producer memory budget per rank in MB; > 0 streams the mesh in z-slabs, one file per slab")
         >> Option('m', "memory",    metadata,       "build and use in-memory metadata")
         >> Option('f', "file",      passthru,       "write file to disk")
-        >> Option('p', "p_frac",    prod_frac,      "fraction of world ranks in producer")
-        >> Option('s', "shared",    shared,         "share ranks between producer and consumer (-p ignored)")
+        >> Option('p', "p_frac",    prod_frac,      "fraction of world ranks (shared and concurrent: cores of each rank) in producer")
+        >> Option(     "placement", placement,      "producer/consumer rank placement: block, interleaved (per node), or a map file")
+        >> Option(     "xfer",      xfer,           "mesh transfer: lowfive (files), shm (shared memory on a node, messages between nodes), native (messages with sets and tags), view (shared mode: producer mesh in place)")
+        >> Option('s', "shared",    shared,         "share ranks between producer and consumer (-p ignored unless concurrent)")
+        >> Option(     "concurrent", concurrent,    "shared mode: run producer and consumer as concurrent threads on disjoint cores")
+        >> Option(     "repart",    repart,         "--xfer shm or native: producer to consumer assignment: rank, or rcb (balanced by mesh location)")
+        >> Option(     "select_dim", select_dim,    "entities needed by the consumer: 0 = vertices, 3 = vertices and cells")
+        >> Option(     "select_sets", select_sets,  "comma-separated tags marking the sets needed by the consumer (default all; part sets are always kept)")
+        >> Option(     "select_tags", select_tags,  "comma-separated tags needed by the consumer (default all)")
+        >> Option(     "out_every", out_every,      "consumer writes its mesh every n time steps (0 = never)")
+        >> Option(     "out_async", out_async,      "consumer writes its mesh in a background thread (0 = off, 1 = on)")
+        >> Option(     "compress",  compress,       "--xfer shm or native: comma-separated datasets compressed in messages: gids, conn, coords, fields, or all")
+        >> Option(     "compress_tol", compress_tol, "compressed fields: 0 = lossless, > 0 = absolute error bound")
         >> Option('r', "prod_exec", producer_exec,  "name of producer executable")
         >> Option('c', "con_exec",  consumer_exec,  "name of consumer executable")
         >> Option('v', "verbose",   verbose,        "print the block contents")
         >> Option('h', "help",      help,           "show help")
         >> Option(     "ntrials",   ntrials,        "number of trials to run")
+        >> Option(     "timers",    timers_file,    "prefix of the per-trial phase timer files (JSON and CSV; empty = print only)")
+        >> Option(     "csv",       csv_file,       "append the configuration and timing of this run as one row of a CSV file")
         ;
 
     if (!ops.parse(argc,argv) || help)
@@ -59,15 +246,82 @@ int main(int argc, char* argv[])
 
 #endif
 
-    int producer_ranks = world.size() * prod_frac;
-    bool producer           = world.rank() < producer_ranks;
     if (world.size() == 1)
         shared = true;
+    int key;                                // order of this rank in its task
+    int placed              = place_ranks(world, placement, prod_frac, key);
+    if (placed < 0)
+    {
+        if (world.rank() == 0)
+            fmt::print(stderr, "Error: invalid placement map {}\n", placement);
+        return 1;
+    }
+    bool producer           = placed;
+    int producer_ranks      = producer ? 1 : 0;
+    MPI_Allreduce(MPI_IN_PLACE, &producer_ranks, 1, MPI_INT, MPI_SUM, world);
+    if (!shared && (producer_ranks == 0 || producer_ranks == world.size()))
+    {
+        if (world.rank() == 0)
+            fmt::print(stderr, "Error: {} placement leaves a task with no ranks\n", placement);
+        return 1;
+    }
 
     if (!shared && world.rank() == 0)
-        fmt::print(stderr, "space partitioning: producer_ranks: {} consumer_ranks: {}\n", producer_ranks, world.size() - producer_ranks);
+        fmt::print(stderr, "space partitioning: producer_ranks: {} consumer_ranks: {} placement: {}\n",
+                producer_ranks, world.size() - producer_ranks, placement);
     if (shared && world.rank() == 0)
         fmt::print(stderr, "space sharing: producer_ranks = consumer_ranks = world: {}\n", world.size());
+    if (xfer != "lowfive" && xfer != "shm" && xfer != "native" && xfer != "view")
+    {
+        if (world.rank() == 0)
+            fmt::print(stderr, "Error: unknown mesh transfer {}\n", xfer);
+        return 1;
+    }
+    if (repart != "rank" && repart != "rcb")
+    {
+        if (world.rank() == 0)
+            fmt::print(stderr, "Error: unknown producer to consumer assignment {}\n", repart);
+        return 1;
+    }
+    MeshCompress mesh_compress;
+    std::stringstream compress_ss(compress);
+    std::string dataset;
+    while (std::getline(compress_ss, dataset, ','))
+    {
+        if (dataset == "gids")
+            mesh_compress.datasets |= MeshCompress::GIDS;
+        else if (dataset == "conn")
+            mesh_compress.datasets |= MeshCompress::CONN;
+        else if (dataset == "coords")
+            mesh_compress.datasets |= MeshCompress::COORDS;
+        else if (dataset == "fields")
+            mesh_compress.datasets |= MeshCompress::FIELDS;
+        else if (dataset == "all")
+            mesh_compress.datasets |= MeshCompress::GIDS | MeshCompress::CONN | MeshCompress::COORDS |
+                MeshCompress::FIELDS;
+        else if (!dataset.empty() && dataset != "none")
+        {
+            if (world.rank() == 0)
+                fmt::print(stderr, "Error: unknown compressed dataset {}\n", dataset);
+            return 1;
+        }
+    }
+    mesh_compress.tol = compress_tol;
+    // the view holds only the current time step, so the consumer must read each step before the producer moves on
+    if (xfer == "view" && (!shared || (!concurrent && steps > 1)))
+    {
+        if (world.rank() == 0)
+            fmt::print(stderr, "Error: --xfer view needs shared mode, and --concurrent 1 for more than one time step\n");
+        return 1;
+    }
+
+    // ghost layers are resolved from the decomposition, which needs one producer block per rank
+    if (ghost > 0 && tot_blocks > 0 && tot_blocks != (shared ? world.size() : producer_ranks))
+    {
+        if (world.rank() == 0)
+            fmt::print(stderr, "Error: -g needs one producer block per producer rank\n");
+        return 1;
+    }
 
     // load tasks
     void* lib_producer = dlopen(producer_exec.c_str(), RTLD_LAZY);
@@ -85,6 +339,16 @@ int main(int argc, char* argv[])
     if (!consumer_f_)
         fmt::print(stderr, "Couldn't find consumer_f\n");
 
+    // init/run/finalize interface, if the tasks export it (otherwise each trial sets up the task again)
+    task_init_t     producer_init_      = (task_init_t)     dlsym(lib_producer, "producer_init");
+    task_run_t      producer_run_       = (task_run_t)      dlsym(lib_producer, "producer_run");
+    task_finalize_t producer_finalize_  = (task_finalize_t) dlsym(lib_producer, "producer_finalize");
+    task_init_t     consumer_init_      = (task_init_t)     dlsym(lib_consumer, "consumer_init");
+    task_run_t      consumer_run_       = (task_run_t)      dlsym(lib_consumer, "consumer_run");
+    task_finalize_t consumer_finalize_  = (task_finalize_t) dlsym(lib_consumer, "consumer_finalize");
+    bool producer_persistent = producer_init_ && producer_run_ && producer_finalize_;
+    bool consumer_persistent = consumer_init_ && consumer_run_ && consumer_finalize_;
+
     // communicator management
     MPI_Comm intercomm_;
     std::vector<communicator> producer_intercomms, consumer_intercomms;
@@ -104,35 +368,82 @@ int main(int argc, char* argv[])
     }
     else
     {
-        MPI_Comm_split(world, producer ? 0 : 1, 0, &local);
+        MPI_Comm_split(world, producer ? 0 : 1, key, &local);
+
+        // world ranks of the leaders (local rank 0) of the producer and the consumer
+        int local_rank;
+        MPI_Comm_rank(local, &local_rank);
+        int leaders[2] = { -1, -1 };
+        if (local_rank == 0)
+            leaders[producer ? 0 : 1] = world.rank();
+        MPI_Allreduce(MPI_IN_PLACE, leaders, 2, MPI_INT, MPI_MAX, world);
 
         if (producer)
         {
-            MPI_Intercomm_create(local, 0, world, /* remote_leader = */ producer_ranks, /* tag = */ 0, &intercomm_);
+            MPI_Intercomm_create(local, 0, world, /* remote_leader = */ leaders[1], /* tag = */ 0, &intercomm_);
             producer_intercomms.push_back(communicator(intercomm_));
             producer_comm = local;
         }
         else
         {
-            MPI_Intercomm_create(local, 0, world, /* remote_leader = */ 0, /* tag = */ 0, &intercomm_);
+            MPI_Intercomm_create(local, 0, world, /* remote_leader = */ leaders[0], /* tag = */ 0, &intercomm_);
             consumer_intercomms.push_back(communicator(intercomm_));
             consumer_comm = local;
         }
     }
 
+    // parameters passed to the tasks
+    TaskParams params;
+    params.mesh_type    = mesh_type;
+    params.mesh_size    = mesh_size;
+    params.mesh_slab    = mesh_slab;
+    params.tot_blocks   = tot_blocks;
+    params.threads      = threads;
+    params.resolve      = resolve;
+    params.stats        = stats;
+    params.ghost        = ghost;
+    params.order        = order;
+    params.steps        = steps;
+    params.delta        = delta;
+    params.mem_budget   = mem_budget;
+    params.timers_file  = timers_file;
+    params.xfer         = xfer;
+    params.repart       = repart;
+    params.select.dim   = select_dim;
+    std::stringstream select_ss(select_tags);
+    std::string tag;
+    while (std::getline(select_ss, tag, ','))
+        if (!tag.empty())
+            params.select.tags.push_back(tag);
+    std::stringstream select_sets_ss(select_sets);
+    while (std::getline(select_sets_ss, tag, ','))
+        if (!tag.empty())
+            params.select.sets.push_back(tag);
+    params.out_every    = out_every;
+    params.out_async    = out_async;
+    params.compress     = mesh_compress;
+    MeshView view;                          // the producer mesh, for the consumer in shared mode
+    params.view         = &view;
+
     // shared MetadataVol plugin
+#ifdef LOWFIVE_PATH
+    l5::MetadataVOL* shared_vol = NULL;
+#endif
     if (shared)
     {
 
 #ifdef LOWFIVE_PATH
 
         l5::MetadataVOL& shared_vol_plugin = l5::MetadataVOL::create_MetadataVOL();
+        shared_vol = &shared_vol_plugin;
         fmt::print(stderr, "prod-con: creating new shared mode MetadataVOL plugin\n");
 
+        // a streamed mesh is one file per z-slab, and a multi-step run one file per time step
+        std::string pattern = MeshPattern(filename, params);
         if (passthru)
-            shared_vol_plugin.set_passthru(filename, "*");
+            shared_vol_plugin.set_passthru(pattern, "*");
         if (metadata)
-            shared_vol_plugin.set_memory(filename, "*");
+            shared_vol_plugin.set_memory(pattern, "*");
         shared_vol_plugin.set_keep(true);
 
 #endif
@@ -140,44 +451,85 @@ int main(int argc, char* argv[])
     }
 
     // declare lambdas for the tasks
+    // one trial of a task: run with the state from its init, or the whole task
+
+    void* producer_task = NULL;             // producer state, from producer_init
+    void* consumer_task = NULL;             // consumer state, from consumer_init
 
     auto producer_f = [&]()
     {
+        if (producer_persistent)
+        {
+            producer_run_(producer_task, params);
+            return;
+        }
         ((void (*) (communicator&,
                     const std::vector<communicator>&,
                     bool,
                     int,
-                    int))
+                    int,
+                    const TaskParams&))
                     (producer_f_))(
                         producer_comm,
                         producer_intercomms,
                         shared,
                         metadata,
-                        passthru);
+                        passthru,
+                        params);
     };
 
     auto consumer_f = [&]()
     {
+        if (consumer_persistent)
+        {
+            consumer_run_(consumer_task, params);
+            return;
+        }
         ((void (*) (communicator&,
                     const std::vector<communicator>&,
                     bool,
                     int,
-                    int))
+                    int,
+                    const TaskParams&))
                     (consumer_f_))(
                         consumer_comm,
                         consumer_intercomms,
                         shared,
                         metadata,
-                        passthru);
+                        passthru,
+                        params);
     };
 
+    // shared mode with concurrent tasks: disjoint cores for the producer and consumer threads on each rank
+    cpu_set_t prod_cores, con_cores;
+    bool pinned = shared && concurrent && split_cores(prod_frac, prod_cores, con_cores);
+    if (shared && concurrent && world.rank() == 0)
+        fmt::print(stderr, "concurrent tasks: producer cores {} consumer cores {}{}\n",
+                pinned ? CPU_COUNT(&prod_cores) : 0, pinned ? CPU_COUNT(&con_cores) : 0, pinned ? "" : " (not pinned)");
+
+    // setup of the tasks, once for all trials and timed separately from them
+    world.barrier();
+    double setup_t0 = MPI_Wtime();
+    if ((shared || producer) && producer_persistent)
+        producer_task = producer_init_(producer_comm, producer_intercomms, shared, metadata, passthru, params);
+    if ((shared || !producer) && consumer_persistent)
+        consumer_task = consumer_init_(consumer_comm, consumer_intercomms, shared, metadata, passthru, params);
+    world.barrier();
+    double setup_time = MPI_Wtime() - setup_t0;
+    if (world.rank() == 0)
+        fmt::print(stderr, "Setup time\t\t\t\t{:.4f} s.\n", setup_time);
+
     std::vector<double> times(ntrials);     // elapsed time for each trial
     double sum_time = 0.0;                  // sum of all times
+    double sum_received = 0.0;              // sum of the bytes received by the consumer over ranks and trials
     for (auto i = 0; i < ntrials; i++)
     {
         // timing
         world.barrier();
         double t0 = MPI_Wtime();
+        params.trial = i;
+        double received = 0.0;
+        params.received = &received;
 
         if (!shared)
         {
@@ -191,6 +543,27 @@ int main(int argc, char* argv[])
                 fmt::print(stderr, "Calling consumer now.\n");
                 consumer_f();
             }
+        } else if (concurrent)
+        {
+            // producer and consumer threads, handing off files through the shared MetadataVOL
+            // the threads they create for block-parallel work inherit their cores
+            Handoff handoff;
+            params.handoff = &handoff;
+            std::thread producer_thread([&]()
+            {
+                if (pinned)
+                    pthread_setaffinity_np(pthread_self(), sizeof(prod_cores), &prod_cores);
+                producer_f();
+            });
+            std::thread consumer_thread([&]()
+            {
+                if (pinned)
+                    pthread_setaffinity_np(pthread_self(), sizeof(con_cores), &con_cores);
+                consumer_f();
+            });
+            producer_thread.join();
+            consumer_thread.join();
+            params.handoff = NULL;
         } else
         {
             // not multithreading, just serializing
@@ -202,10 +575,25 @@ int main(int argc, char* argv[])
         world.barrier();
         times[i] = MPI_Wtime() - t0;
         sum_time += times[i];
+        params.received = NULL;
+        MPI_Allreduce(MPI_IN_PLACE, &received, 1, MPI_DOUBLE, MPI_SUM, world);
+
+#ifdef LOWFIVE_PATH
+        // release the files of the trial, so that memory does not grow from one trial to the next
+        if (shared_vol)
+            shared_vol->clear_files();
+#endif
+        sum_received += received;
         if (world.rank() == 0)
             fmt::print(stderr, "Elapsed time for trial {}\t\t{:.4f} s.\n", i, times[i]);
     }
 
+    // release the tasks
+    if (producer_task)
+        producer_finalize_(producer_task);
+    if (consumer_task)
+        consumer_finalize_(consumer_task);
+
     // timing stats
     double mean_time    = sum_time / ntrials;
     double var_time     = 0.0;
@@ -215,10 +603,39 @@ int main(int argc, char* argv[])
 
     if (world.rank() == 0)
     {
-        fmt::print(stderr, "\nMean elapsed time for {} trials\t\t{:.4f} s.\n", ntrials, mean_time);
+        fmt::print(stderr, "\nSetup time (not in trials)\t\t{:.4f} s.\n", setup_time);
+        fmt::print(stderr, "Mean elapsed time for {} trials\t\t{:.4f} s.\n", ntrials, mean_time);
         fmt::print(stderr, "Variance\t\t\t\t{:.4f}\n", var_time);
         fmt::print(stderr, "Standard deviation\t\t\t{:.4f}\n", sqrt(var_time));
         fmt::print(stderr, "Minimum\t\t\t\t\t{:.4f} s.\n", *(std::min_element(times.begin(), times.end())));
         fmt::print(stderr, "Maximum\t\t\t\t\t{:.4f} s.\n", *(std::max_element(times.begin(), times.end())));
     }
+
+    // one row of benchmark results: the configuration, the elapsed times, and the bytes received by the consumer
+    // per trial with the effective bandwidth
+    if (!csv_file.empty() && world.rank() == 0)
+    {
+        FILE* csv = fopen(csv_file.c_str(), "a");
+        if (!csv)
+            fmt::print(stderr, "Couldn't open {}\n", csv_file);
+        else
+        {
+            fseek(csv, 0, SEEK_END);
+            if (ftell(csv) == 0)
+                fmt::print(csv, "mesh_type,mesh_size,mesh_slab,nprocs,producer_ranks,consumer_ranks,shared,concurrent,"
+                        "transport,threads,steps,delta,ntrials,setup_time,mean_time,min_time,max_time,mb,mb_per_s\n");
+            double mb = sum_received / ntrials / 1048576.0;
+            std::string transport = UseMeshXfer(params, shared) || UseMeshView(params, shared) ? xfer :
+                (metadata ? "memory" : "passthru");
+            if (UseMeshXfer(params, shared) && mesh_compress.datasets)
+                transport += "+z";
+            fmt::print(csv, "{},{},{},{},{},{},{},{},{},{},{},{},{},{:.6f},{:.6f},{:.6f},{:.6f},{:.3f},{:.3f}\n",
+                    mesh_type, mesh_size, mesh_slab, world.size(),
+                    shared ? world.size() : producer_ranks, shared ? world.size() : world.size() - producer_ranks,
+                    shared ? 1 : 0, concurrent ? 1 : 0, transport, threads, steps, delta,
+                    ntrials, setup_time, mean_time, *(std::min_element(times.begin(), times.end())),
+                    *(std::max_element(times.begin(), times.end())), mb, mean_time > 0 ? mb / mean_time : 0.0);
+            fclose(csv);
+        }
+    }
 }
@@ -1,12 +1,19 @@
 #pragma once
 
 #include    <vector>
+#include    <string>
+#include    <algorithm>
+#include    <functional>
+#include    <cmath>
+#include    <limits>
 #include    <cassert>
 #include    <thread>
 #include    <mutex>
+#include    <condition_variable>
 
 // diy
 #include    <diy/mpi/communicator.hpp>
+#include    <diy/master.hpp>
 #include    <diy/decomposition.hpp>
 #include    <diy/assigner.hpp>
 
@@ -33,13 +40,216 @@ namespace l5        = LowFive;
 #include    "MBTagConventions.hpp"
 #include    "moab/ParallelComm.hpp"
 #include    "moab/HomXform.hpp"
+#include    "moab/ScdInterface.hpp"
 #include    "moab/ReadUtilIface.hpp"
+#include    "moab/TupleList.hpp"
+#include    "moab/Skinner.hpp"
 
 using communicator  = MPI_Comm;
 using diy_comm      = diy::mpi::communicator;
 using Bounds        = diy::DiscreteBounds;
 
 
+// hand-off of the producer files to the consumer when both tasks run as concurrent threads on the same ranks
+// file i is written by the producer and then read by the consumer, and the two threads take turns accessing HDF5,
+// so that their collective I/O happens in the same order on all ranks; everything else overlaps
+struct Handoff
+{
+    // producer: waits until the consumer is done with file i - 1
+    void    begin_write(int i)      { wait_for(2 * i); }
+    // producer: file i is ready
+    void    end_write(int i)        { advance(2 * i + 1); }
+    // consumer: waits until file i is ready
+    void    begin_read(int i)       { wait_for(2 * i + 1); }
+    // consumer: done with file i
+    void    end_read(int i)         { advance(2 * i + 2); }
+
+    private:
+    void    wait_for(int p)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return phase == p; });
+    }
+    void    advance(int p)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            phase = p;
+        }
+        cv.notify_all();
+    }
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    int                     phase = 0;      // 2 i: producer writes file i, 2 i + 1: consumer reads file i
+};
+
+// phases of the producer and consumer tasks, timed on every rank
+enum Phase
+{
+    PHASE_GENERATE,                         // create vertices, cells, and global ids
+    PHASE_RESOLVE,                          // resolve shared entities (and ghosts)
+    PHASE_FIELDS,                           // compute the fields
+    PHASE_STATS,                            // mesh statistics
+    PHASE_WRITE,                            // write_file (or the fields of a time step)
+    PHASE_BROADCAST,                        // lowfive broadcast_files
+    PHASE_SERVE,                            // lowfive serve_all
+    PHASE_WAIT,                             // wait for the other task
+    PHASE_LOAD,                             // load_file (or the fields of a time step)
+    PHASE_VERIFY,                           // verify the fields
+    PHASE_DEBUG_WRITE,                      // consumer debug write_file (in the background with --out_async)
+    PHASE_SNAPSHOT,                         // consumer snapshot of the mesh for a background write
+    PHASE_COMPRESS,                         // producer compression of the packed mesh (--compress)
+    PHASE_DECOMPRESS,                       // consumer decompression of the packed mesh (--compress)
+    NUM_PHASES
+};
+
+inline const char* PhaseName(int phase)
+{
+    static const char* names[NUM_PHASES] = { "generate", "resolve", "fields", "stats", "write", "broadcast", "serve",
+        "wait", "load", "verify", "debug_write", "snapshot", "compress", "decompress" };
+    return names[phase];
+}
+
+// accumulated time and number of calls of each phase of a task on one rank
+// different phases may be timed concurrently by different threads
+struct PhaseTimers
+{
+    double  time[NUM_PHASES]    = {};
+    int     calls[NUM_PHASES]   = {};
+};
+
+// times one phase from construction until stop() or destruction; does nothing if timers is null
+struct PhaseTimer
+{
+            PhaseTimer(PhaseTimers* timers, Phase phase):
+                timers(timers), phase(phase), t0(MPI_Wtime())       {}
+            ~PhaseTimer()                                           { stop(); }
+
+    void    stop()
+    {
+        if (!timers)
+            return;
+        timers->time[phase] += MPI_Wtime() - t0;
+        timers->calls[phase]++;
+        timers = NULL;
+    }
+
+    PhaseTimers*    timers;
+    Phase           phase;
+    double          t0;
+};
+
+// read-only view of the producer mesh, handed to the consumer in shared mode without copying or serializing it
+// (--xfer view); the consumer uses the producer's moab instance in place until it is done with the time step
+struct MeshView
+{
+    moab::Interface*    mbi     = NULL;     // producer moab interface
+    moab::ParallelComm* pc      = NULL;     // producer moab communicator
+    moab::EntityHandle  root    = 0;        // producer mesh set
+    int                 version = -1;       // version of the mesh topology
+    int                 step    = -1;       // time step of the field values
+};
+
+// entities, sets, and tags of the producer mesh that the consumer needs (--select_dim, --select_sets, --select_tags)
+// with --xfer shm or native the rest is never packed or transferred; with files it is dropped right after loading
+// the part sets and their PARALLEL_PARTITION tag are always kept, since later steps and writes depend on them
+struct MeshSelect
+{
+    int                         dim = 3;    // highest dimension of the entities (0 = vertices, 3 = vertices and cells)
+    std::vector<std::string>    sets;       // names of the tags marking the sets to keep (empty = all sets)
+    std::vector<std::string>    tags;       // names of the tags (empty = all)
+
+    bool    tag(const std::string& name) const
+    {
+        return tags.empty() || std::find(tags.begin(), tags.end(), name) != tags.end();
+    }
+};
+
+// datasets of the packed meshes compressed in the messages of --xfer shm (between nodes) and --xfer native
+// (--compress, --compress_tol)
+// global ids and connectivity: delta + zigzag varint; coordinates and fields: byte shuffle + zlib, lossless, or for the
+// fields only, rounded to a multiple of 2 tol (error at most tol) and delta + zigzag varint encoded
+struct MeshCompress
+{
+    enum { GIDS = 1, CONN = 2, COORDS = 4, FIELDS = 8 };
+
+    int     datasets    = 0;                // bits of the compressed datasets (0 = none)
+    double  tol         = 0.0;              // fields: 0 = lossless, > 0 = absolute error bound
+};
+
+// parameters passed from prod-con to the producer and consumer tasks
+struct TaskParams
+{
+    int     mesh_type   = 0;                // producer mesh type (0 = hex, 1 = tet, 2 = structured hex)
+    int     tot_blocks  = -1;               // total number of blocks in the producer mesh (-1 = one per rank)
+    int     threads     = 1;                // number of threads for block-parallel work
+    int     resolve     = 0;                // shared entity resolution (0 = moab resolve_shared_ents,
+                                            // 1 = from the decomposition, 2 = 1 validated against 0)
+    int     mesh_size   = 10;               // producer mesh size (vertices) per side
+    int     mesh_slab   = 0;                // producer block shape (0 = cubes, 1 = slabs)
+    int     stats       = 1;                // compute and print producer mesh statistics (0 = off, e.g., in timed runs)
+    int     ghost       = 0;                // number of ghost layers generated around each block (one block per rank)
+    int     order       = 0;                // order of generated vertices and cells within a block
+                                            // (0 = i-j-k, 1 = Morton, 2 = Hilbert; i-j-k only for structured hex)
+    int     steps       = 1;                // number of time steps written by the producer and read by the consumer
+    int     delta       = 0;                // time steps after the first carry only the fields, not the topology
+    int     mem_budget  = 0;                // producer memory budget per rank in MB (0 = generate the whole mesh at once,
+                                            // > 0 = stream the mesh in z-slabs, one file per slab)
+    int     trial       = 0;                // trial number, for the timer output files
+    std::string timers_file;                // prefix of the timer output files (empty = print only)
+    Handoff* handoff    = NULL;             // shared mode with concurrent tasks: turns of producer and consumer I/O
+    PhaseTimers* timers = NULL;             // phase timers of the task (set by the task itself)
+    double*  received   = NULL;             // (output) bytes received by the consumer on this rank
+    std::string xfer    = "lowfive";        // producer-to-consumer transport (lowfive = write_file/load_file through
+                                            // lowfive, shm = packed meshes in shared memory on a node, messages
+                                            // between nodes, native = packed meshes with their sets and tags in
+                                            // messages, view = the producer mesh in place, shared mode only)
+    MeshView* view      = NULL;             // shared mode with --xfer view: the producer mesh of the current step
+    std::string repart  = "rank";           // --xfer shm: assignment of producer ranks to consumer ranks (rank =
+                                            // contiguous ranges of ranks, rcb = recursive coordinate bisection of
+                                            // the centroids of the producer meshes, weighted by their cells)
+    MeshSelect select;                      // entities and tags needed by the consumer
+    int     out_every   = 1;                // the consumer writes its mesh every out_every time steps (0 = never)
+    int     out_async   = 0;                // the consumer writes its mesh in a background thread, from a snapshot
+    MeshCompress compress;                  // --xfer shm: datasets compressed in the messages between nodes
+};
+
+// vertices created by one block of the generated mesh, one contiguous range of i per (j,k) row of the block bounds
+// row r corresponds to j = bounds.min[1] + r % ny, k = bounds.min[2] + r / ny
+struct VertRows
+{
+    std::vector<int>    lo;                 // first i created in each row
+    std::vector<int>    hi;                 // last i created in each row (hi < lo if none)
+    std::vector<int>    off;                // position of the first vertex of each row in the block's vertex sequence
+};
+
+// calls f(begin, end) on contiguous chunks of [0, n), one chunk per thread
+template<class F>
+void parallel_for(size_t n, int threads, const F& f)
+{
+    if (threads > (int)n)
+        threads = n;
+    if (threads <= 1)
+    {
+        f(0, n);
+        return;
+    }
+
+    size_t chunk = (n + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++)
+    {
+        size_t begin = t * chunk;
+        size_t end   = std::min(n, begin + chunk);
+        if (begin < end)
+            workers.emplace_back([&f, begin, end]() { f(begin, end); });
+    }
+    f(0, std::min(n, chunk));
+    for (auto& w : workers)
+        w.join();
+}
+
 enum {producer_task, producer1_task, producer2_task, consumer_task, consumer1_task, consumer2_task};
 
 #define ERR {if(rval!=MB_SUCCESS)printf("MOAB error at line %d in %s\n", __LINE__, __FILE__);}
@@ -47,26 +257,300 @@ enum {producer_task, producer1_task, producer2_task, consumer_task, consumer1_ta
 using namespace moab;
 
 void hex_mesh_gen(int *mesh_size, Interface *mbint, EntityHandle *mesh_set,
-        ParallelComm *mbpc, diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign);
+        ParallelComm *mbpc, diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign,
+        const TaskParams& params);
 void tet_mesh_gen(int *mesh_size, Interface *mbint, EntityHandle *mesh_set,
-        ParallelComm *mbpc, diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign);
+        ParallelComm *mbpc, diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign,
+        const TaskParams& params);
+void scd_mesh_gen(int *mesh_size, Interface *mbint, EntityHandle *mesh_set,
+        ParallelComm *mbpc, diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign,
+        const TaskParams& params);
 void create_hexes_and_verts(int *mesh_size, Interface *mbint, EntityHandle *mesh_set,
-        diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign, ParallelComm* mbpc);
+        diy::Master& master, ParallelComm* mbpc, int order = 0);
 void create_tets_and_verts(int *mesh_size, Interface *mbint, EntityHandle *mesh_set,
-        diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign, ParallelComm* mbpc);
+        diy::Master& master, ParallelComm* mbpc, int order = 0);
+void create_scd_hexes_and_verts(int *mesh_size, Interface *mbint, EntityHandle *mesh_set,
+        diy::Master& master, ParallelComm* mbpc);
+void* dense_tag_data(Interface *mbint, Tag tag, EntityHandle start, int num);
+void vert_gids_kernel(const int *mesh_size, const Bounds& bounds, const VertRows& rows, long *gids, int threads,
+        const int *order = NULL);
+void cell_gids_kernel(const int *mesh_size, const Bounds& bounds, int cells_per_space, long *gids, int threads,
+        const int *order = NULL);
+diy::RegularDecomposer<Bounds> decompose_domain(int src_size, int slab, int nblocks, int ghost = 0);
+void create_mesh(int mesh_type, int *mesh_size, Interface *mbint, EntityHandle *mesh_set, ParallelComm *mbpc,
+        diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign, const TaskParams& params);
 void resolve_and_exchange(Interface *mbint, EntityHandle *mesh_set, ParallelComm *mbpc);
+void resolve_by_gids(Interface *mbint, EntityHandle *mesh_set, ParallelComm *mbpc);
+void resolve_from_decomposition(int *mesh_size, Interface *mbint, EntityHandle *mesh_set, ParallelComm *mbpc,
+        diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign, diy::Master& master);
+void resolve_ghosts_from_decomposition(int cells_per_space, Interface *mbint, EntityHandle *mesh_set, ParallelComm *mbpc,
+        diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign, diy::Master& master);
+void validate_resolve(int *mesh_size, int mesh_type, Interface *mbint, ParallelComm *mbpc,
+        diy::RegularDecomposer<Bounds>& decomp, diy::RoundRobinAssigner& assign, const TaskParams& params);
+
+// return a value for the field position (simple magnitude)
+inline double PhysField(double x, double y, double z, double factor)
+{
+    return factor * sqrt(x * x + y * y + z * z);
+}
+
+// analytic field evaluated on a batch of points in SoA form: f[i] = field(x[i], y[i], z[i]), i < n
+using FieldKernel = std::function<void(const double* x, const double* y, const double* z, size_t n, double* f)>;
+
+FieldKernel PhysFieldKernel(double factor);
+
+// views of the coordinate arrays of a range of vertices, one per contiguous run of handles
+struct VertexCoords
+{
+    std::vector<EntityHandle>   start;          // first handle of each run
+    std::vector<int>            count;          // number of vertices in each run
+    std::vector<double*>        x, y, z;        // coordinate arrays of each run
+    std::vector<int>            run;            // run of each handle from the first one, -1 if none (empty if sparse)
+
+    ErrorCode   init(Interface *mbi, const Range& verts);
+    int         find(EntityHandle h, double& vx, double& vy, double& vz) const;
+};
 
-double PhysField(double x, double y, double z, double factor);
+void cell_centroids(const VertexCoords& vcoords, const EntityHandle *conn, int nv, size_t n,
+        double *cx, double *cy, double *cz, int threads);
 
-void PutElementField(Interface *mbi, EntityHandle eh, const char *tagname, double factor);
+void PutField(Interface *mbi, EntityHandle eh, const char *tagname, int dim, const FieldKernel& kernel, int threads);
 
-void GetElementField(Interface *mbi, EntityHandle eh, const char *tagname, double factor, MPI_Comm comm, bool debug);
+// errors of a field against its reference values: L1 = mean |error|, L2 = root mean square error, Linf = max |error|
+struct FieldError
+{
+    long long   n       = 0;                // number of values
+    double      l1      = 0.0;              // sum of |error|
+    double      l2      = 0.0;              // sum of error^2
+    double      linf    = 0.0;              // max |error|
 
-void PutVertexField(Interface *mbi, EntityHandle eh, const char *tagname, double factor);
+    void        combine(const FieldError& other);
+    double      norm_l1() const             { return n ? l1 / n : 0.0; }
+    double      norm_l2() const             { return n ? sqrt(l2 / n) : 0.0; }
+};
 
-void GetVertexField(Interface *mbi, EntityHandle eh, const char *tagname, double factor, MPI_Comm comm, bool debug);
+FieldError CheckField(Interface *mbi, EntityHandle eh, const char *tagname, int dim, const FieldKernel& kernel,
+        MPI_Comm comm, int threads);
+
+void PutElementField(Interface *mbi, EntityHandle eh, const char *tagname, double factor, int threads);
+
+bool GetElementField(Interface *mbi, EntityHandle eh, const char *tagname, double factor, MPI_Comm comm, int threads,
+        bool debug, double tol);
+
+void PutVertexField(Interface *mbi, EntityHandle eh, const char *tagname, double factor, int threads);
+
+bool GetVertexField(Interface *mbi, EntityHandle eh, const char *tagname, double factor, MPI_Comm comm, int threads,
+        bool debug, double tol);
 
 void PrintMeshStats(Interface *mbint, EntityHandle *mesh_set, ParallelComm *mbpc);
 
-void PrepMesh(int src_type, int src_size, int slab, Interface* mbi, ParallelComm* pc, EntityHandle root, double factor,
+void SetMeshVersion(Interface *mbi, EntityHandle eh, int version);
+int GetMeshVersion(Interface *mbi);
+void WriteFields(Interface *mbi, ParallelComm *pc, EntityHandle eh, const std::string& filename, int version,
+        MPI_Comm comm);
+bool ReadFields(Interface *mbi, EntityHandle eh, const std::string& filename, int version, MPI_Comm comm,
+        size_t& bytes);
+
+void ReportPhaseTimers(const PhaseTimers& timers, const char* task, MPI_Comm comm, const TaskParams& params);
+
+void PrepMesh(int src_type, int src_size, int slab, const TaskParams& params, Interface* mbi, ParallelComm* pc, EntityHandle root, double factor,
         bool debug);
+
+// name of a file with a suffix inserted before its extension, e.g., example1.h5m, _slab3 -> example1_slab3.h5m
+inline std::string SuffixFilename(const std::string& filename, const std::string& suffix)
+{
+    size_t dot = filename.rfind('.');
+    if (dot == std::string::npos)
+        return filename + suffix;
+    return filename.substr(0, dot) + suffix + filename.substr(dot);
+}
+
+// name of the file holding z-slab s of a streamed mesh, e.g., example1.h5m -> example1_slab3.h5m
+inline std::string StreamFilename(const std::string& filename, int s)
+{
+    return SuffixFilename(filename, "_slab" + std::to_string(s));
+}
+
+// name of the file holding time step k of the producer mesh, e.g., example1.h5m -> example1_step3.h5m
+inline std::string StepFilename(const std::string& filename, int k)
+{
+    return SuffixFilename(filename, "_step" + std::to_string(k));
+}
+
+// number of time steps written by the producer; a streamed mesh is written in one step
+inline int NumSteps(const TaskParams& params)
+{
+    return params.mem_budget > 0 ? 1 : std::max(params.steps, 1);
+}
+
+// whether time step k carries only the fields of the mesh written at an earlier step
+inline bool DeltaStep(const TaskParams& params, int k)
+{
+    return params.delta && k > 0;
+}
+
+// name of the file holding only the fields of time step k, e.g., example1.h5m -> example1_step3_fields.h5m
+// the extension is kept so that the name matches MeshPattern, and lowfive handles it like the other step files
+inline std::string FieldsFilename(const std::string& filename, int k)
+{
+    return SuffixFilename(StepFilename(filename, k), "_fields");
+}
+
+// scaling factor of the producer fields at time step k
+inline double StepFactor(int k)
+{
+    return 1.0 + k;
+}
+
+// file name pattern matching all the files of the producer mesh (see MeshFilenames)
+inline std::string MeshPattern(const std::string& filename, const TaskParams& params)
+{
+    if (params.mem_budget > 0)
+        return SuffixFilename(filename, "_slab*");
+    if (NumSteps(params) > 1)
+        return SuffixFilename(filename, "_step*");
+    return filename;
+}
+
+int StreamSlabs(const TaskParams& params, int nprocs, int* layers = 0);
+
+std::vector<std::string> MeshFilenames(const std::string& filename, const TaskParams& params, int nprocs);
+
+void StreamMesh(const TaskParams& params, MPI_Comm comm, double factor, const std::string& outfile,
+        const std::string& write_opts);
+
+// mesh of one producer rank packed into a single buffer of 8-byte words, transferred to the consumer without HDF5
+// this header is followed by the vertex global ids, the vertex coordinates (x, y, z of each vertex), the cell global
+// ids, the cell connectivity (as vertex global ids), the vertex field, and the cell field; only the two fields if the
+// topology is not packed
+// cells and fields not selected by the consumer (see MeshSelect) are left out
+// with the topology, the arrays may be followed by the sets and the other tags of the mesh (see PackSets)
+struct MeshHeader
+{
+    long    version;                        // version of the mesh topology
+    long    topology;                       // 1 = vertices, cells, and fields; 0 = fields only
+    long    nverts;                         // number of vertices
+    long    ncells;                         // number of cells
+    long    cell_type;                      // moab entity type of the cells
+    long    verts_per_cell;                 // number of vertices per cell
+    long    vert_field;                     // 1 = the vertex field is packed
+    long    cell_field;                     // 1 = the cell field is packed
+    long    compressed  = 0;                // 1 = the arrays are compressed (in a message only, see MeshCompress)
+    long    sets        = 0;                // bytes of the sets and tags after the arrays (0 = none)
+
+    // size of the packed mesh, including this header
+    size_t  bytes() const
+    {
+        size_t words = (vert_field ? nverts : 0) + (cell_field ? ncells : 0);   // fields
+        if (topology)
+            words += nverts * 4 + ncells * (1 + verts_per_cell);
+        return sizeof(MeshHeader) + words * 8 + sets;
+    }
+};
+
+// vertices and cells created by UnpackMesh from each packed mesh, in the order in which they were packed, so that the
+// fields of later time steps of the same mesh version can be patched in place
+struct MeshIndex
+{
+    int                                         version = -1;   // version of the unpacked mesh
+    std::vector<std::vector<EntityHandle>>      verts;          // vertices of each packed mesh
+    std::vector<std::vector<EntityHandle>>      cells;          // cells of each packed mesh
+};
+
+size_t PackMesh(Interface* mbi, EntityHandle eh, int version, bool topology, const MeshSelect& select, char* buf,
+        const std::vector<char>* sets = NULL);
+
+size_t PackSets(Interface* mbi, EntityHandle eh, const MeshSelect& select, std::vector<char>& out);
+
+void SelectMesh(Interface* mbi, EntityHandle eh, const MeshSelect& select, bool keep_gids);
+size_t MeshDataBytes(Interface* mbi);
+
+void UnpackMesh(Interface* mbi, ParallelComm* pc, EntityHandle eh, const std::vector<const char*>& bufs,
+        MeshIndex& index);
+
+bool UnpackFields(Interface* mbi, const std::vector<const char*>& bufs, const MeshIndex& index);
+
+// whether the tasks transfer the mesh with MeshXfer instead of files
+// shared mode and streamed meshes always go through lowfive
+inline bool UseMeshXfer(const TaskParams& params, bool shared)
+{
+    return (params.xfer == "shm" || params.xfer == "native") && !shared && params.mem_budget <= 0;
+}
+
+// whether the consumer reads the producer mesh in place, through params.view, instead of files
+inline bool UseMeshView(const TaskParams& params, bool shared)
+{
+    return params.xfer == "view" && shared && params.mem_budget <= 0 && params.view;
+}
+
+// transport of packed meshes from the producer ranks to the consumer ranks, set up collectively by both tasks
+// each producer rank sends to one consumer rank (by default producer rank p to consumer rank p * ncons / nprod, or
+// by recursive coordinate bisection of the producer meshes, see repart); a consumer on the same node maps the packed mesh directly
+// from an MPI-3 shared memory window, while a consumer on another node receives it in a message over the intercomm
+// a step is released, and the producer may overwrite its buffer, when all the ranks of the node have started the next
+// step or finished the trial
+// messages may be compressed (see MeshCompress); the consumer receives them decompressed
+// native: every peer receives messages, even on the same node, and the topology steps carry the sets and the other
+// tags of the mesh, for a complete migration of the mesh without HDF5
+// the consumer tells receive whether the step carries the topology (DeltaStep), as it does for files
+struct MeshXfer
+{
+            MeshXfer(MPI_Comm intercomm, bool producer, bool native, const std::string& repart,
+                     const MeshCompress& compress, Interface* mbi = NULL, EntityHandle eh = 0);
+            ~MeshXfer();
+
+    // producer: packs the mesh of this rank for step k and makes it available to its consumer rank
+    void    send(Interface* mbi, EntityHandle eh, int version, bool topology, const MeshSelect& select, int k,
+                 PhaseTimers* timers);
+
+    // consumer: waits for step k and returns the packed meshes of its producer ranks, valid until the next step
+    const std::vector<const char*>& receive(int k, bool topology, PhaseTimers* timers, size_t& bytes);
+
+    // both: ends the trial, releasing the last step
+    void    finish(PhaseTimers* timers);
+
+    private:
+    void    release(PhaseTimers* timers);
+    void    publish(MPI_Aint need, bool topology, PhaseTimers* timers);
+    void    free_plan();
+    bool    plan_fields() const     { return !(compress.datasets & MeshCompress::FIELDS); }
+
+    MPI_Comm                    intercomm;              // duplicate of the producer-consumer intercomm
+    MPI_Comm                    all;                    // producer ranks, then consumer ranks
+    MPI_Comm                    node;                   // producer and consumer ranks of this node
+    bool                        producer;
+    bool                        native;                 // messages only, with the sets and tags
+    std::vector<int>            peers;                  // consumer: producer ranks sending to this rank
+                                                        // producer: the consumer rank receiving from this rank
+    std::vector<int>            peer_node_ranks;        // rank of each peer in node, -1 = on another node
+    bool                        pending = false;        // a step is published and not yet released
+
+    MPI_Win                     win = MPI_WIN_NULL;     // shared memory window of the packed meshes on this node
+    char*                       base = NULL;            // this rank's part of the window
+    MPI_Aint                    capacity = 0;           // size of this rank's part of the window
+
+    std::vector<char>           send_buf;               // producer: packed mesh sent in a message
+    std::vector<char>           sets_buf;               // producer, native: packed sets and tags
+    MPI_Request                 send_req = MPI_REQUEST_NULL;
+    std::vector<std::vector<char>>  recv_bufs;          // consumer: packed meshes received in messages
+    std::vector<const char*>    bufs;                   // consumer: packed meshes of the current step
+
+    // plan of the fields-only steps of a mesh version, whose sizes and peers are those of the topology step before
+    // them: persistent requests replayed at every step, with no probing or window resizing
+    static const int            fields_tag = 32767;     // tag of the fields-only messages
+    int                         plan_version = -1;      // mesh version of the plan (-1 = none)
+    int                         recv_version = -1;      // consumer: mesh version of the last topology step
+    std::vector<char>           fields_buf;             // producer: packed fields sent by fields_send_req
+    MPI_Request                 fields_send_req = MPI_REQUEST_NULL;
+    std::vector<MPI_Request>    fields_recv_reqs;       // consumer: persistent receives from the peers on other nodes
+    std::vector<size_t>         peer_fields_bytes;      // consumer: size of the packed fields of each peer
+
+    // compression of the messages, and its totals in the current trial
+    // compressed fields vary in size, so fields-only steps are then sent like topology steps, without the plan
+    MeshCompress                compress;
+    std::vector<char>           zip_buf;                // producer: compressed message
+    std::vector<std::vector<char>>  raw_bufs;           // consumer: decompressed messages
+    double                      raw_bytes   = 0;        // bytes compressed (producer) or decompressed (consumer)
+    double                      zip_bytes   = 0;        // producer: bytes of the compressed messages
+    double                      zip_time    = 0;        // seconds spent compressing or decompressing
+};
@@ -1,3 +1,6 @@
+#include <map>
+#include <set>
+#include <thread>
 #include "prod-con.hpp"
 
 herr_t fail_on_hdf5_error(hid_t stack_id, void*)
@@ -13,33 +16,102 @@ void producer_f (
         const std::vector<communicator>& intercomms,
         bool shared,
         int metadata,
-        int passthru);
-}
+        int passthru,
+        const TaskParams& params);
 
-void producer_f (
+void* producer_init (
         communicator& local,
         const std::vector<communicator>& intercomms,
         bool shared,
         int metadata,
-        int passthru)
+        int passthru,
+        const TaskParams& params);
+
+void producer_run (
+        void* task,
+        const TaskParams& params);
+
+void producer_finalize (
+        void* task);
+}
+
+// state of the producer built once by producer_init and reused by every producer_run: communicators, lowfive
+// plugin and callbacks, and the moab mesh
+struct ProducerTask
 {
-    diy::mpi::communicator local_(local);
+    communicator                    local;
+    std::vector<communicator>       intercomms;
+    bool                            shared;
+    int                             metadata;
+    int                             passthru;
+
     std::string infile      = "/home/tpeterka/software/spack/var/spack/environments/moab-example-env/moab-example/sample_data/mpas_2d_source_p128.h5m";
     std::string read_opts   = "PARALLEL=READ_PART;PARTITION=PARALLEL_PARTITION;PARALLEL_RESOLVE_SHARED_ENTS;DEBUG_IO=3;";
     std::string outfile     = "example1.h5m";
     std::string write_opts  = "PARALLEL=WRITE_PART;DEBUG_IO=6";
 
+    std::vector<std::string>        outfiles;           // output files, in the order they are written
+    std::map<std::string, int>      nafc;               // number of times after file close callback was called, per file
+    std::set<std::string>           fields_outfiles;    // output files written by WriteFields instead of moab
+    std::thread                     server;             // serves a time step to the consumer while the next step is prepared
+    PhaseTimers                     timers;             // phase timers of the current setup or trial
+
+    l5::DistMetadataVOL*            vol_plugin = NULL;  // lowfive plugin (not shared mode)
+    MeshXfer*                       xfer = NULL;        // transport of the mesh without files (--xfer other than lowfive)
+
+    Interface*                      mbi = NULL;         // moab interface
+    ParallelComm*                   pc  = NULL;         // moab communicator
+    EntityHandle                    root;
+    int                             mesh_version = 0;   // version of the mesh topology, changes when the topology does
+    int                             fields_step = 0;    // time step of the current field values
+
+    bool is_outfile(const std::string& name) const
+    {
+        return std::find(outfiles.begin(), outfiles.end(), name) != outfiles.end();
+    }
+};
+
+// builds the producer: lowfive plugin and callbacks, and the mesh with its fields (unless streamed in each trial)
+void* producer_init (
+        communicator& local,
+        const std::vector<communicator>& intercomms,
+        bool shared,
+        int metadata,
+        int passthru,
+        const TaskParams& params_)
+{
+    ProducerTask* t = new ProducerTask;
+    t->local        = local;
+    t->intercomms   = intercomms;
+    t->shared       = shared;
+    t->metadata     = metadata;
+    t->passthru     = passthru;
+
+    diy::mpi::communicator local_(local);
+
+    // phase timers, passed with the task parameters to mesh generation
+    TaskParams params = params_;
+    params.timers = &t->timers;
+
     // debug
-    fmt::print(stderr, "producer: local comm rank {} size {} metadata {} passthru {}\n",
-            local_.rank(), local_.size(), metadata, passthru);
+    fmt::print(stderr, "producer: local comm rank {} size {} metadata {} passthru {} blocks {} threads {}\n",
+            local_.rank(), local_.size(), metadata, passthru, params.tot_blocks, params.threads);
 
-    int nafc = 0;               // number of times after file close callback was called
+    // output files: outfile, one file per z-slab when streaming the mesh within a memory budget, or one file per
+    // time step
+    t->outfiles = MeshFilenames(t->outfile, params, local_.size());
+    if (params.mem_budget <= 0 && NumSteps(params) > 1)
+        for (int k = 0; k < NumSteps(params); k++)
+            if (DeltaStep(params, k))
+                t->fields_outfiles.insert(t->outfiles[k]);
+    std::string out_pattern = MeshPattern(t->outfile, params);
 
     if (shared)                 // single process, MetadataVOL test
         fmt::print(stderr, "producer: using shared mode MetadataVOL plugin created by prod-con\n");
     else                        // normal multiprocess, DistMetadataVOL plugin
     {
         l5::DistMetadataVOL& vol_plugin = l5::DistMetadataVOL::create_DistMetadataVOL(local, intercomms);
+        t->vol_plugin = &vol_plugin;
 
         // set lowfive properties
         if (passthru)
@@ -47,30 +119,33 @@ void producer_f (
             // debug
             fmt::print(stderr, "*** producer setting passthru mode\n");
 
-            vol_plugin.set_passthru(outfile, "*");
+            vol_plugin.set_passthru(out_pattern, "*");
         }
         if (metadata)
         {
             // debug
             fmt::print(stderr, "*** producer setting memory mode\n");
 
-            vol_plugin.set_memory(outfile, "*");
+            vol_plugin.set_memory(out_pattern, "*");
         }
-        vol_plugin.set_passthru(infile, "*");      // infile comes from disk
-        vol_plugin.set_intercomm(infile, "*", 0);
+        vol_plugin.set_passthru(t->infile, "*");      // infile comes from disk
+        vol_plugin.set_intercomm(t->infile, "*", 0);
 
         vol_plugin.set_keep(true);
         vol_plugin.serve_on_close = false;
 
         // set a callback to broadcast/receive files before a file open
-        vol_plugin.set_before_file_open([&](const std::string& name)
+        vol_plugin.set_before_file_open([t](const std::string& name)
         {
-            if (name == outfile)
-                vol_plugin.broadcast_files();
+            if (t->is_outfile(name))
+            {
+                PhaseTimer broadcast(&t->timers, PHASE_BROADCAST);
+                t->vol_plugin->broadcast_files();
+            }
         });
 
         // set a callback to indicate noncollective dataset writes (e.g., only rank 0 writes the history dset)
-        vol_plugin.set_noncollective_datasets([&]()
+        vol_plugin.set_noncollective_datasets([]()
         {
             std::set<std::string> noncollective_datasets;
             noncollective_datasets.insert("history");
@@ -78,75 +153,235 @@ void producer_f (
         });
 
         // set a callback to serve files after a file close
-        vol_plugin.set_after_file_close([&](const std::string& name)
+        // every file but the last is served in the background, overlapping the preparation of the next time step;
+        // the file is kept in memory by lowfive, so the mesh may be modified while it is being served
+        // moab's writer closes a file twice on rank 0, and the consumer opens it twice; a fields file is closed once
+        // by WriteFields, and opened once by ReadFields
+        vol_plugin.set_after_file_close([t](const std::string& name)
         {
-            if (name != outfile)
+            if (!t->is_outfile(name))
                 return;
 
-            if (local_.rank() == 0)
+            int rank;
+            MPI_Comm_rank(t->local, &rank);
+            bool fields = t->fields_outfiles.count(name) > 0;
+            if ((fields || rank > 0 || t->nafc[name] > 0) && !t->vol_plugin->is_passthru(name, "*"))
             {
-                if (nafc > 0)
+                auto serve = [t, fields]()
                 {
-                    if (!vol_plugin.is_passthru(outfile, "*"))
-                    {
-                        vol_plugin.serve_all();
-                        vol_plugin.serve_all();
-                    }
-                }
-            }
-            else
-            {
-                if (!vol_plugin.is_passthru(outfile, "*"))
-                {
-                    vol_plugin.serve_all();
-                    vol_plugin.serve_all();
-                }
+                    PhaseTimer timer(&t->timers, PHASE_SERVE);
+                    t->vol_plugin->serve_all();
+                    if (!fields)
+                        t->vol_plugin->serve_all();
+                };
+                if (name != t->outfiles.back())
+                    t->server = std::thread(serve);
+                else
+                    serve();
             }
 
-            nafc++;
+            t->nafc[name]++;
         });
     }
 
-    // create moab mesh
-    int                             mesh_type = 0;                          // source mesh type (0 = hex, 1 = tet)
-    int                             mesh_size = 10;                        // source mesh size per side
-    int                             mesh_slab = 0;                          // block shape (0 = cubes; 1 = slabs)
-    double                          factor = 1.0;                           // scaling factor on field values
-    Interface*                      mbi = new Core();                       // moab interface
-    ParallelComm*                   pc  = new ParallelComm(mbi, local);     // moab communicator
-    EntityHandle                    root;
-    ErrorCode                       rval;
-    rval = mbi->create_meshset(MESHSET_SET, root); ERR(rval);
+    // create moab mesh; a streamed mesh is generated slab by slab in each trial instead
+    if (params.mem_budget <= 0)
+    {
+        int                         mesh_type = params.mesh_type;           // source mesh type (0 = hex, 1 = tet, 2 = structured hex)
+        int                         mesh_size = params.mesh_size;           // source mesh size per side
+        int                         mesh_slab = params.mesh_slab;           // block shape (0 = cubes; 1 = slabs)
+        ErrorCode                   rval;
+        t->mbi = new Core();
+        t->pc  = new ParallelComm(t->mbi, local);
+        rval = t->mbi->create_meshset(MESHSET_SET, t->root); ERR(rval);
 
 #if 1
 
-    // create mesh in memory
-    fmt::print(stderr, "*** producer generating synthetic mesh in memory ***\n");
-    PrepMesh(mesh_type, mesh_size, mesh_slab, mbi, pc, root, factor, false);
-    fmt::print(stderr, "*** producer after creating mesh in memory ***\n");
+        // create mesh in memory
+        fmt::print(stderr, "*** producer generating synthetic mesh in memory ***\n");
+        PrepMesh(mesh_type, mesh_size, mesh_slab, params, t->mbi, t->pc, t->root, StepFactor(0), false);
+        fmt::print(stderr, "*** producer after creating mesh in memory ***\n");
+        SetMeshVersion(t->mbi, t->root, t->mesh_version);
 
 #else
 
-    // or
+        // or
 
-    // read file
-    fmt::print(stderr, "*** producer reading input file ***\n");
-    rval = mbi->load_file(infile.c_str(), &root, read_opts.c_str() ); ERR(rval);
-    fmt::print(stderr, "*** producer after reading file ***\n");
+        // read file
+        fmt::print(stderr, "*** producer reading input file ***\n");
+        rval = t->mbi->load_file(t->infile.c_str(), &t->root, t->read_opts.c_str() ); ERR(rval);
+        fmt::print(stderr, "*** producer after reading file ***\n");
 
 #endif
+    }
+
+    // transport of the mesh to the consumer without files, assigned to consumer ranks by the location of the mesh
+    if (UseMeshXfer(params, shared))
+        t->xfer = new MeshXfer(intercomms[0], true, params.xfer == "native", params.repart, params.compress,
+                t->mbi, t->root);
+
+    // setup time
+    params.trial = -1;
+    ReportPhaseTimers(t->timers, "producer", local, params);
+    return t;
+}
+
+// one trial of the producer: writes each time step (or each slab of a streamed mesh) and hands it to the consumer
+void producer_run (
+        void* task,
+        const TaskParams& params_)
+{
+    ProducerTask* t = static_cast<ProducerTask*>(task);
+    diy::mpi::communicator local_(t->local);
+    ErrorCode rval;
+
+    // phase timers of this trial, passed with the task parameters to mesh generation
+    t->timers = PhaseTimers();
+    t->nafc.clear();
+    TaskParams params = params_;
+    params.timers = &t->timers;
+
+    if (params.mem_budget > 0)
+    {
+        // generate and write the mesh one z-slab at a time
+        fmt::print(stderr, "*** producer streaming synthetic mesh ***\n");
+        StreamMesh(params, t->local, StepFactor(0), t->outfile, t->write_opts);
+        fmt::print(stderr, "*** producer after streaming mesh ***\n");
+    }
+    else
+    {
+        // fields of the first time step, if a previous trial advanced them
+        if (t->fields_step != 0)
+        {
+            PhaseTimer fields(&t->timers, PHASE_FIELDS);
+            PutVertexField(t->mbi, t->root, "vertex_field", StepFactor(0), params.threads);
+            PutElementField(t->mbi, t->root, "element_field", StepFactor(0), params.threads);
+            t->fields_step = 0;
+        }
+
+        // time steps: the mesh is generated once, and only its fields change from one step to the next
+        // step k is written and handed to the consumer, while the fields of step k + 1 are computed
+        // (with a view, the consumer reads the fields in place, and those of step k + 1 wait for it)
+        int nsteps = NumSteps(params);
+        bool view = UseMeshView(params, t->shared);
+        for (int k = 0; k < nsteps; k++)
+        {
+            double t0 = MPI_Wtime();
+
+            // write file: the whole mesh, or only its fields once the consumer has the topology
+            if (params.handoff)
+            {
+                PhaseTimer wait(&t->timers, PHASE_WAIT);
+                params.handoff->begin_write(k);
+            }
+            if (view)
+            {
+                params.view->mbi        = t->mbi;
+                params.view->pc         = t->pc;
+                params.view->root       = t->root;
+                params.view->version    = t->mesh_version;
+                params.view->step       = k;
+            }
+            else if (t->xfer)
+                t->xfer->send(t->mbi, t->root, t->mesh_version, !DeltaStep(params, k), params.select, k, &t->timers);
+            else
+            {
+                PhaseTimer write(&t->timers, PHASE_WRITE);
+                if (DeltaStep(params, k))
+                    WriteFields(t->mbi, t->pc, t->root, t->outfiles[k], t->mesh_version, t->local);
+                else
+                {
+                    rval = t->mbi->write_file(t->outfiles[k].c_str(), 0, t->write_opts.c_str(), &t->root, 1); ERR(rval);
+                }
+            }
+            if (params.handoff)
+                params.handoff->end_write(k);
+
+            // signal the consumer that the step is ready
+            if (t->passthru && !t->metadata && !t->shared && !t->xfer && k < nsteps - 1)
+            {
+                PhaseTimer wait(&t->timers, PHASE_WAIT);
+                for (auto& intercomm: t->intercomms)
+                    diy_comm(intercomm).barrier();
+            }
+            double t1 = MPI_Wtime();
+
+            // prepare the next step
+            if (k < nsteps - 1)
+            {
+                if (view && params.handoff)
+                {
+                    PhaseTimer wait(&t->timers, PHASE_WAIT);
+                    params.handoff->begin_write(k + 1);
+                }
+                PhaseTimer fields(&t->timers, PHASE_FIELDS);
+                PutVertexField(t->mbi, t->root, "vertex_field", StepFactor(k + 1), params.threads);
+                PutElementField(t->mbi, t->root, "element_field", StepFactor(k + 1), params.threads);
+                t->fields_step = k + 1;
+            }
+            double t2 = MPI_Wtime();
+
+            // wait for the step to be served before writing the next one
+            if (t->server.joinable())
+            {
+                PhaseTimer wait(&t->timers, PHASE_WAIT);
+                t->server.join();
+            }
+            double t3 = MPI_Wtime();
 
-    // write file
-    rval = mbi->write_file(outfile.c_str(), 0, write_opts.c_str(), &root, 1); ERR(rval);
+            if (local_.rank() == 0 && nsteps > 1)
+                fmt::print(stderr, "producer: step {} write {:.3f} s prepare next {:.3f} s wait for serve {:.3f} s\n",
+                        k, t1 - t0, t2 - t1, t3 - t2);
+        }
+    }
 
     // debug
     fmt::print(stderr, "*** producer after writing file ***\n");
 
-    // signal the consumer that data are ready
-    if (passthru && !metadata && !shared)
+    // signal the consumer that data are ready (the last time step or slab)
+    if (t->passthru && !t->metadata && !t->shared && !t->xfer)
     {
-        for (auto& intercomm: intercomms)
+        PhaseTimer wait(&t->timers, PHASE_WAIT);
+        for (auto& intercomm: t->intercomms)
             diy_comm(intercomm).barrier();
     }
     fmt::print(stderr, "*** producer after barrier completed! ***\n");
+
+    // the consumer is done with the last time step
+    if (t->xfer)
+        t->xfer->finish(&t->timers);
+
+    // the files have been served; release them so that memory does not grow from one trial to the next
+    if (t->vol_plugin && t->metadata)
+    {
+        for (auto& name : t->outfiles)
+            t->vol_plugin->drop(name);
+    }
+
+    ReportPhaseTimers(t->timers, "producer", t->local, params);
+}
+
+// releases the producer mesh
+void producer_finalize (
+        void* task)
+{
+    ProducerTask* t = static_cast<ProducerTask*>(task);
+    delete t->xfer;
+    delete t->pc;
+    delete t->mbi;
+    delete t;
+}
+
+// the whole producer in one call: setup, one trial, and cleanup
+void producer_f (
+        communicator& local,
+        const std::vector<communicator>& intercomms,
+        bool shared,
+        int metadata,
+        int passthru,
+        const TaskParams& params)
+{
+    void* task = producer_init(local, intercomms, shared, metadata, passthru, params);
+    producer_run(task, params);
+    producer_finalize(task);
 }
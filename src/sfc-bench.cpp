@@ -0,0 +1,167 @@
+// benchmark for the order of generated vertices and cells within a block:
+// i-j-k vs. Morton vs. Hilbert order, timed on shared entity resolution, file writing, and consumer-like traversals
+
+#include    <diy/mpi.hpp>
+#include    "opts.h"
+
+#include    "prod-con.hpp"
+
+// for each vertex, averages the element field over the cells adjacent to the vertex
+// returns the sum of the averages, so that the traversal is not optimized away
+double vert_to_cell_traversal(Interface *mbi,           // moab interface instance
+        EntityHandle root,                              // moab mesh set
+        Tag field_tag)                                  // element field tag
+{
+    ErrorCode rval;
+    Range verts;
+    rval = mbi->get_entities_by_dimension(root, 0, verts); ERR;
+
+    double sum = 0.0;
+    std::vector<EntityHandle> adj;
+    std::vector<double> vals;
+    for (Range::iterator it = verts.begin(); it != verts.end(); it++)
+    {
+        EntityHandle v = *it;
+        adj.clear();
+        rval = mbi->get_adjacencies(&v, 1, 3, false, adj); ERR;
+        if (adj.empty())
+            continue;
+        vals.resize(adj.size());
+        rval = mbi->tag_get_data(field_tag, &adj[0], adj.size(), &vals[0]); ERR;
+        double avg = 0.0;
+        for (size_t i = 0; i < vals.size(); i++)
+            avg += vals[i];
+        sum += avg / vals.size();
+    }
+    return sum;
+}
+
+// for each cell, computes the centroid of its vertices
+// returns the sum of the centroid coordinates, so that the traversal is not optimized away
+double cell_to_vert_traversal(Interface *mbi,           // moab interface instance
+        EntityHandle root)                              // moab mesh set
+{
+    ErrorCode rval;
+    Range cells;
+    rval = mbi->get_entities_by_dimension(root, 3, cells); ERR;
+
+    double sum = 0.0;
+    std::vector<double> coords;
+    for (Range::iterator it = cells.begin(); it != cells.end(); it++)
+    {
+        const EntityHandle* conn;
+        int nv;
+        rval = mbi->get_connectivity(*it, conn, nv); ERR;
+        coords.resize(3 * nv);
+        rval = mbi->get_coords(conn, nv, &coords[0]); ERR;
+        double c = 0.0;
+        for (int i = 0; i < 3 * nv; i++)
+            c += coords[i];
+        sum += c / nv;
+    }
+    return sum;
+}
+
+int main(int argc, char* argv[])
+{
+    diy::mpi::environment     env(argc, argv);
+    diy::mpi::communicator    world;
+
+    int                       size              = 64;             // mesh size per side
+    int                       mesh_type         = 0;              // mesh type (0 = hex, 1 = tet)
+    int                       tot_blocks        = -1;             // one block per rank
+    int                       threads           = 1;              // number of threads for generating blocks
+    std::string               outfile           = "sfc-bench.h5m";
+    bool                      help;
+
+    // get command line arguments
+    using namespace opts;
+    Options ops;
+    ops
+        >> Option('t', "thread",    threads,        "number of threads")
+        >> Option(     "size",      size,           "mesh size (vertices per side)")
+        >> Option(     "mesh_type", mesh_type,      "mesh type: 0 = hex, 1 = tet")
+        >> Option('b', "blocks",    tot_blocks,     "total number of blocks (default one per rank)")
+        >> Option('o', "outfile",   outfile,        "file written for the write timing")
+        >> Option('h', "help",      help,           "show help")
+        ;
+
+    if (!ops.parse(argc,argv) || help)
+    {
+        if (world.rank() == 0)
+        {
+            std::cout << "Usage: " << argv[0] << " [OPTIONS]\n";
+            std::cout << "Compares i-j-k, Morton, and Hilbert order of the generated vertices and cells.\n";
+            std::cout << ops;
+        }
+        return 1;
+    }
+
+    int mesh_size[3] = {size, size, size};
+    tot_blocks = std::max(tot_blocks, world.size());
+    diy::RoundRobinAssigner         assigner(world.size(), tot_blocks);
+    diy::RegularDecomposer<Bounds>  decomposer = decompose_domain(size, 0, tot_blocks);
+    std::string write_opts = world.size() > 1 ? "PARALLEL=WRITE_PART" : "";
+
+    if (world.rank() == 0)
+        fmt::print(stderr, "{} mesh of size {} in {} blocks\n{:>8} {:>10} {:>12} {:>10} {:>12} {:>12}\n",
+                mesh_type == 0 ? "hex" : "tet", size, tot_blocks,
+                "order", "gen (s)", "resolve (s)", "write (s)", "v->c (s)", "c->v (s)");
+
+    const char* names[3] = {"i-j-k", "Morton", "Hilbert"};
+    for (int order = 0; order < 3; order++)
+    {
+        TaskParams params;
+        params.mesh_type    = mesh_type;
+        params.tot_blocks   = tot_blocks;
+        params.threads      = threads;
+        params.order        = order;
+
+        Interface*      mbi = new Core();
+        ParallelComm*   pc  = new ParallelComm(mbi, world);
+        EntityHandle    root;
+        ErrorCode       rval;
+        rval = mbi->create_meshset(MESHSET_SET, root); ERR;
+
+        double times[5];
+
+        world.barrier();
+        double t0 = MPI_Wtime();
+        create_mesh(mesh_type, mesh_size, mbi, &root, pc, decomposer, assigner, params);
+        times[0] = MPI_Wtime() - t0;
+
+        world.barrier();
+        t0 = MPI_Wtime();
+        resolve_and_exchange(mbi, &root, pc);
+        times[1] = MPI_Wtime() - t0;
+
+        PutElementField(mbi, root, "element_field", 1.0, threads);
+
+        world.barrier();
+        t0 = MPI_Wtime();
+        rval = mbi->write_file(outfile.c_str(), 0, write_opts.c_str(), &root, 1); ERR;
+        times[2] = MPI_Wtime() - t0;
+
+        Tag field_tag;
+        rval = mbi->tag_get_handle("element_field", 1, MB_TYPE_DOUBLE, field_tag); ERR;
+        t0 = MPI_Wtime();
+        double check = vert_to_cell_traversal(mbi, root, field_tag);
+        times[3] = MPI_Wtime() - t0;
+
+        t0 = MPI_Wtime();
+        check += cell_to_vert_traversal(mbi, root);
+        times[4] = MPI_Wtime() - t0;
+
+        // report the slowest rank
+        double max_times[5];
+        MPI_Reduce(times, max_times, 5, MPI_DOUBLE, MPI_MAX, 0, world);
+        if (world.rank() == 0)
+            fmt::print(stderr, "{:>8} {:>10.4f} {:>12.4f} {:>10.4f} {:>12.4f} {:>12.4f}\n",
+                    names[order], max_times[0], max_times[1], max_times[2], max_times[3], max_times[4]);
+        if (check != check)
+            fmt::print(stderr, "Error: rank {} traversal of {} order produced NaN\n", world.rank(), names[order]);
+
+        delete pc;
+        delete mbi;
+    }
+}